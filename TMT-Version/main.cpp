@@ -4,11 +4,32 @@
 #include <QWidget>
 #include <QPainter>
 #include <QKeyEvent>
-#include <QTimer>
+#include <QWheelEvent>
+#include <QScrollBar>
+#include <QSocketNotifier>
 #include <QFontMetrics>
 #include <QVector>
 #include <QColor>
 #include <QResizeEvent>
+#include <QPaintEvent>
+#include <QRegion>
+#include <QMutex>
+
+#include <atomic>
+#include <string.h>
+
+#include "framescheduler.h"
+#include "cellgrid.h"
+#include "glyphatlas.h"
+#include "historyview.h"
+#include "latencyprobe.h"
+#include "perfcounters.h"
+#include "renderbench.h"
+#include "ptyreader.h"
+#include "ptywriter.h"
+#include "parserworker.h"
+#include "scrollback.h"
+#include "triplebuffer.h"
 
 extern "C" {
 #include "tmt.h"
@@ -20,12 +41,15 @@ extern "C" {
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 }
 
 constexpr int TERM_ROWS = 24;
 constexpr int TERM_COLS = 80;
+constexpr int READ_CHUNK = 64 * 1024;
+constexpr int DEFAULT_READ_BUDGET = 256 * 1024;
 
 class TerminalWidget : public QWidget {
     Q_OBJECT
@@ -33,40 +57,254 @@ class TerminalWidget : public QWidget {
 public:
     TerminalWidget(QWidget *parent = nullptr) : QWidget(parent) {
         setFocusPolicy(Qt::StrongFocus);
+        setAttribute(Qt::WA_OpaquePaintEvent); // paintEvent fills what it repaints
         initFont();
+        initScrollBar();
+        frameScheduler.setCounters(&counters);
         initPTY();
         initTMT();
-        startTimer();
+        startReadNotifier();
     }
 
     ~TerminalWidget() {
+        if (latency.isEnabled()) fputs(qPrintable(latency.report()), stderr);
+        if (counters.isEnabled()) fputs(qPrintable(counters.report()), stderr);
+        if (!traceFile.isEmpty()) counters.writeTrace(traceFile);
+        if (reader) reader->stop();
+        delete worker;
+        delete reader;
+        delete writer;
+        if (readNotifier) readNotifier->setEnabled(false);
         if (vt) tmt_close(vt);
         if (pid > 0) kill(pid, SIGKILL);
         if (masterFd >= 0) ::close(masterFd);
     }
 
+    // Bytes handed to tmt_write() per wakeup at most; the rest stays in the
+    // PTY until the next event loop iteration.
+    void setReadBudget(int bytes) { budget = qMax(bytes, 1); }
+    int readBudget() const { return budget; }
+    int bytesReadLastFrame() const { return lastFrameBytes; }
+
+    // Optional background reader: a thread owns masterFd and fills a
+    // lock-free ring, the GUI thread drains it when signalled.
+    void setThreadedReads(bool on) {
+        if (masterFd < 0 || worker || on == (reader != nullptr)) return;
+        if (on) {
+            readNotifier->setEnabled(false);
+            reader = new PtyReader(masterFd);
+            reader->setCounters(&counters);
+            reader->setDataCallback([this]() {
+                latency.outputRead();
+                QMetaObject::invokeMethod(this, [this]() { drainReader(); }, Qt::QueuedConnection);
+            });
+            reader->start();
+        } else {
+            reader->stop();
+            while (!reader->ring().isEmpty()) drainReader();
+            delete reader;
+            reader = nullptr;
+            readNotifier->setEnabled(true);
+        }
+    }
+    bool threadedReads() const { return reader != nullptr; }
+
+    // Run tmt_write() off the GUI thread too. The worker owns vt and, at
+    // frame boundaries, publishes a copy of the screen into a triple buffer
+    // that paintEvent reads without locking.
+    void setThreadedParsing(bool on) {
+        if (masterFd < 0 || on == (worker != nullptr)) return;
+        if (on) {
+            setThreadedReads(false);
+            readNotifier->setEnabled(false);
+            reader = new PtyReader(masterFd);
+            worker = new ParserWorker(reader);
+            reader->setCounters(&counters);
+            reader->setDataCallback([this]() {
+                latency.outputRead();
+                worker->wake();
+            });
+            worker->setParseFunction([this](const char *data, size_t len) {
+                qint64 start = counters.now();
+                counters.parsed(data, len);
+                tmt_write(vt, data, len);
+                counters.span("parse", start, counters.now(), qint64(len));
+            });
+            worker->setPublishFunction([this]() { publishFrame(); });
+            worker->setFrameCallback([this]() {
+                if (!framePosted.exchange(true))
+                    QMetaObject::invokeMethod(this, [this]() { presentFrame(); }, Qt::QueuedConnection);
+            });
+            publishFrame();
+            frames.acquire();
+            worker->start();
+            reader->start();
+        } else {
+            reader->stop();
+            delete worker;
+            worker = nullptr;
+            // vt belongs to the GUI thread again; parse what the worker left.
+            while (!reader->ring().isEmpty()) drainReader();
+            delete reader;
+            reader = nullptr;
+            readNotifier->setEnabled(true);
+            frameScheduler.requestFrame();
+        }
+    }
+    bool threadedParsing() const { return worker != nullptr; }
+
+    // Repaints for output are paced to maxFramesPerSecond (0 = display
+    // refresh rate); low-latency mode paints the first frame after idle
+    // immediately.
+    void setMaxFramesPerSecond(int fps) { frameScheduler.setMaxFramesPerSecond(fps); }
+    int maxFramesPerSecond() const { return frameScheduler.maxFramesPerSecond(); }
+    void setLowLatencyFirstFrame(bool on) { frameScheduler.setLowLatencyFirstFrame(on); }
+    bool lowLatencyFirstFrame() const { return frameScheduler.lowLatencyFirstFrame(); }
+
+    // Cells are blitted from a cache of pre-rendered glyphs; disabling it
+    // falls back to one drawText() per run of same-attribute cells.
+    void setGlyphAtlasEnabled(bool on) { atlasEnabled = on; update(); }
+    bool glyphAtlasEnabled() const { return atlasEnabled; }
+
+    // Lines scrolled off the top are kept in a compressed history capped
+    // at this many bytes; the oldest lines are dropped first.
+    void setScrollbackLimit(qint64 bytes) {
+        QMutexLocker lock(&scrollbackLock);
+        scrollback.setMaxBytes(bytes);
+    }
+    qint64 scrollbackLimit() const {
+        QMutexLocker lock(&scrollbackLock);
+        return scrollback.maxBytes();
+    }
+    int scrollbackLines() const {
+        QMutexLocker lock(&scrollbackLock);
+        return scrollback.lineCount();
+    }
+
+    // Lines past the limit spill to a memory-mapped file instead of being
+    // dropped. With keep set, a file that already holds history is reopened
+    // and remapped, and the file is left on disk when the widget goes away;
+    // without it the file is created afresh and must not exist yet.
+    bool setScrollbackFile(const QString &path, bool keep = false) {
+        bool ok;
+        {
+            QMutexLocker lock(&scrollbackLock);
+            ok = scrollback.setSpillFile(path, keep ? Scrollback::KeepOnClose : Scrollback::RemoveOnClose);
+        }
+        history.reset();
+        syncHistory();
+        return ok;
+    }
+    QString scrollbackFile() const {
+        QMutexLocker lock(&scrollbackLock);
+        return scrollback.spillFile();
+    }
+
+    // Queues bytes for the child as if typed; see ptywriter.h. Pastes of
+    // any size are fine: they are written as fast as the child reads.
+    void sendInput(const QByteArray &bytes) {
+        if (writer)
+            writer->write(bytes);
+    }
+
+    // Keystroke-to-paint latency per stage (see latencyprobe.h). While it
+    // is enabled, Ctrl+Shift+L prints the histograms to stderr, and so
+    // does closing the widget.
+    void setLatencyProbeEnabled(bool on) { latency.setEnabled(on); }
+    bool latencyProbeEnabled() const { return latency.isEnabled(); }
+    QString latencyReport() const { return latency.report(); }
+
+    // Pipeline counters and the per-frame trace (see perfcounters.h), both
+    // off until enabled here. Closing the widget prints the counters to
+    // stderr and writes the trace to the trace file, if one is set.
+    PerfCounters &perfCounters() { return counters; }
+    const PerfCounters &perfCounters() const { return counters; }
+    void setTraceFile(const QString &path) {
+        traceFile = path;
+        counters.setTracing(!path.isEmpty());
+    }
+
+    // History lines shown above the screen; 0 follows the live output.
+    int scrollOffset() const { return history.offset(); }
+    void scrollToBottom() { scrollBar->setValue(scrollBar->maximum()); }
+
+    // paintEvent timings on fixed screens, as JSON (see renderbench.h).
+    // Overwrites the screen; run it without threaded parsing.
+    QByteArray renderBenchmark(int frames = RenderBench::DefaultFrames) {
+        RenderBench bench(this, "tmt", [this](const RenderFixture &f) {
+            resize(f.cols * charW + scrollBar->sizeHint().width(), f.rows * charH);
+            const TMTSCREEN *s = tmt_screen(vt);
+            QVector<PackedCell> line(int(s->ncol));
+            for (size_t y = 0; y < s->nline; ++y) {
+                for (int x = 0; x < line.size(); ++x)
+                    line[x] = f.cell(int(y), x);
+                memcpy(s->lines[y]->chars, historyRow(line.constData(), line.size()), s->ncol * sizeof(TMTCHAR));
+            }
+        }, [this](bool on) { setGlyphAtlasEnabled(on); });
+        return bench.run(frames);
+    }
+
+signals:
+    void outputConsumed(int bytes);
+
 protected:
-    void paintEvent(QPaintEvent*) override {
+    void paintEvent(QPaintEvent *event) override {
+        latency.paintStarted();
+        qint64 paintStart = counters.now();
         QPainter p(this);
-        p.fillRect(rect(), Qt::black);
-        const TMTSCREEN *s = tmt_screen(vt);
+        const QRegion &region = event->region();
+        p.fillRect(event->rect(), Qt::black);
+        glyphs.setDevicePixelRatio(devicePixelRatioF());
 
-        for (int y = 0; y < rows; ++y) {
-            for (int x = 0; x < cols; ++x) {
-                const TMTCHAR *ch = &s->lines[y]->chars[x];
-                QChar qch = QString::fromUtf8(ch->c, ch->cw).at(0);
-                QColor fg = ch->fg == TMT_COLOR_DEFAULT ? Qt::white : QColor::fromRgb(ch->fg);
-                p.setPen(fg);
-                p.drawText(x * charW, (y + 1) * charH - baseline, qch);
+        // With threaded parsing vt belongs to the worker; paint its latest
+        // published copy instead.
+        const Frame *f = worker ? &frames.front() : nullptr;
+        const TMTSCREEN *s = f ? nullptr : tmt_screen(vt);
+        int nrows = f ? f->rows : int(s->nline);
+        int ncols = f ? f->cols : int(s->ncol);
+
+        // Scrolled back, the top rows come from the history and the screen
+        // moves down; only the visible history lines are decoded.
+        int back = history.offset();
+        quint64 cellsPainted = 0;
+        for (int y = 0; y < nrows; ++y) {
+            // Rows outside the update region are still on screen.
+            if (!region.intersects(QRect(0, y * charH, width(), charH))) continue;
+            cellsPainted += ncols;
+            const TMTCHAR *line;
+            if (y < back) {
+                QMutexLocker lock(&scrollbackLock);
+                line = historyRow(history.line(scrollback, history.lineAt(y), ncols), ncols);
+            } else {
+                line = f ? f->cells.constData() + (y - back) * ncols : s->lines[y - back]->chars;
+            }
+            int x = 0;
+            while (x < ncols) {
+                int end = x + 1;
+                while (end < ncols && sameRun(line[end].a, line[x].a)) ++end;
+                drawRun(p, line, x, end, y);
+                x = end;
             }
         }
 
-        if (s->cursor->visible) {
-            p.fillRect(s->cursor->c * charW, s->cursor->r * charH, charW, charH, Qt::gray);
+        TMTPOINT cur = f ? f->cursor : *tmt_cursor(vt);
+        if ((f ? f->cursorVisible : cursorShown) && int(cur.r) + back < nrows) {
+            p.fillRect(int(cur.c) * charW, (int(cur.r) + back) * charH, charW, charH, Qt::gray);
         }
+        counters.painted(paintStart, cellsPainted);
+        latency.paintFinished();
     }
 
     void keyPressEvent(QKeyEvent *e) override {
+        if (latency.isEnabled() && e->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier) && e->key() == Qt::Key_L) {
+            fputs(qPrintable(latency.report()), stderr);
+            return;
+        }
+        if ((e->modifiers() & Qt::ShiftModifier) && (e->key() == Qt::Key_PageUp || e->key() == Qt::Key_PageDown)) {
+            scrollBar->triggerAction(e->key() == Qt::Key_PageUp ? QAbstractSlider::SliderPageStepSub
+                                                                : QAbstractSlider::SliderPageStepAdd);
+            return;
+        }
         QByteArray bytes = e->text().toUtf8();
         if (e->key() == Qt::Key_Backspace) bytes = "\x7f";
         else if (e->key() == Qt::Key_Return) bytes = "\r";
@@ -74,23 +312,75 @@ protected:
         else if (e->key() == Qt::Key_Right) bytes = "\x1b[C";
         else if (e->key() == Qt::Key_Up) bytes = "\x1b[A";
         else if (e->key() == Qt::Key_Down) bytes = "\x1b[B";
-        if (!bytes.isEmpty()) write(masterFd, bytes.data(), bytes.size());
+        if (bytes.isEmpty()) return;
+        latency.keyPressed();
+        scrollToBottom();
+        sendInput(bytes);
+    }
+
+    void wheelEvent(QWheelEvent *e) override {
+        scrollBar->setValue(scrollBar->value() - e->angleDelta().y() / 40);
     }
 
     void resizeEvent(QResizeEvent *) override {
-        cols = width() / charW;
-        rows = height() / charH;
+        int barWidth = scrollBar->sizeHint().width();
+        scrollBar->setGeometry(width() - barWidth, 0, barWidth, height());
+        cols = qMax(2, (width() - barWidth) / charW);
+        rows = qMax(2, height() / charH);
+        scrollBar->setPageStep(rows);
+        if (worker) {
+            int r = rows, c = cols;
+            worker->post([this, r, c]() { tmt_resize(vt, r, c); });
+        } else {
+            tmt_resize(vt, rows, cols);
+        }
         struct winsize ws = { (unsigned short)rows, (unsigned short)cols, 0, 0 };
         ioctl(masterFd, TIOCSWINSZ, &ws);
         kill(pid, SIGWINCH);
     }
 
 private:
+    // Copy of the TMT screen handed from the parser worker to paintEvent.
+    struct Frame {
+        int rows = 0, cols = 0;
+        QVector<TMTCHAR> cells;
+        TMTPOINT cursor = { 0, 0 };
+        bool cursorVisible = true;
+        qint64 historyFirst = 0;    // the history as of this screen
+        int historyLines = 0;
+    };
+
     TMT *vt = nullptr;
     int masterFd = -1;
     pid_t pid = -1;
+    QSocketNotifier *readNotifier = nullptr;
+    PtyReader *reader = nullptr;
+    PtyWriter *writer = nullptr;
+    ParserWorker *worker = nullptr;
+    TripleBuffer<Frame> frames;
+    FrameScheduler frameScheduler{this};
+    std::atomic<bool> framePosted{false};
+    bool cursorShown = true;
+    int cursorRow = 0;
+    QRegion rowDamage;          // in rows, owned by whichever thread owns vt
+    QMutex damageLock;          // guards publishedDamage and frames.publish()
+    QRegion publishedDamage;    // in rows, damage of the published frames
+    QByteArray readBuffer = QByteArray(READ_CHUNK, Qt::Uninitialized);
+    int budget = DEFAULT_READ_BUDGET;
+    int lastFrameBytes = 0;
     int rows = TERM_ROWS, cols = TERM_COLS;
     int charW = 10, charH = 18, baseline = 4;
+    GlyphAtlas glyphs;
+    mutable QMutex scrollbackLock;  // the parsing thread pushes, the GUI reads
+    Scrollback scrollback;
+    QVector<PackedCell> pushedLine;
+    HistoryView history;        // GUI thread only
+    QVector<TMTCHAR> historyCells;
+    QScrollBar *scrollBar = nullptr;
+    LatencyProbe latency;
+    PerfCounters counters;
+    QString traceFile;
+    bool atlasEnabled = true;
 
     void initFont() {
         QFont f("Courier", 12);
@@ -99,6 +389,97 @@ private:
         charW = fm.horizontalAdvance('M');
         charH = fm.height();
         baseline = fm.descent();
+        glyphs.setFont(f, charW, charH, baseline);
+    }
+
+    void initScrollBar() {
+        scrollBar = new QScrollBar(Qt::Vertical, this);
+        scrollBar->setRange(0, 0);
+        connect(scrollBar, &QScrollBar::valueChanged, this, &TerminalWidget::scrollHistory);
+    }
+
+    // GUI thread: bring the viewport and the scroll bar up to date with the
+    // history behind the screen about to be painted.
+    void syncHistory() {
+        qint64 first;
+        int count;
+        if (worker) {
+            first = frames.front().historyFirst;
+            count = frames.front().historyLines;
+        } else {
+            QMutexLocker lock(&scrollbackLock);
+            first = scrollback.droppedLines();
+            count = scrollback.lineCount();
+        }
+        // New lines push a scrolled-back screen further down.
+        if (history.setHistory(first, count)) frameScheduler.requestFrame();
+        QSignalBlocker block(scrollBar);
+        scrollBar->setRange(0, history.lineCount());
+        scrollBar->setValue(history.scrollValue());
+    }
+
+    // The rows still visible after a scroll are blitted; Qt repaints only
+    // the rows scrolled into view.
+    void scrollHistory(int value) {
+        int before = history.offset();
+        history.scrollTo(value);
+        int delta = history.offset() - before;
+        if (delta) frameScheduler.requestScroll(QRect(0, 0, scrollBar->x(), rows * charH), 0, delta * charH);
+    }
+
+    // A history line as TMT cells, so both halves of a scrolled-back view
+    // go through drawRun(). Valid until the next call.
+    const TMTCHAR *historyRow(const PackedCell *l, int ncol) {
+        historyCells.resize(ncol);
+        for (int i = 0; i < ncol; ++i) {
+            TMTCHAR &c = historyCells[i];
+            c.c = wchar_t(l[i].isBlank() ? ' ' : l[i].ch);
+            c.a = TMTATTRS();
+            c.a.bold = l[i].attrs & PackedCell::Bold;
+            c.a.underline = l[i].attrs & PackedCell::Underline;
+            c.a.reverse = l[i].attrs & PackedCell::Inverse;
+            c.a.fg = tmtColorOf(l[i].fg);
+            c.a.bg = tmtColorOf(l[i].bg);
+        }
+        return historyCells.constData();
+    }
+
+    static bool sameRun(const TMTATTRS &a, const TMTATTRS &b) {
+        return a.fg == b.fg && a.bg == b.bg && a.bold == b.bold
+            && a.underline == b.underline && a.reverse == b.reverse;
+    }
+
+    // Cells [x, end) of row y share colours and style: one fillRect for the
+    // background and, without the atlas, one drawText for the text.
+    void drawRun(QPainter &p, const TMTCHAR *line, int x, int end, int y) {
+        const TMTATTRS &a = line[x].a;
+        QColor fg = tmtColor(a.fg, Qt::white);
+        QColor bg = tmtColor(a.bg, Qt::black);
+        if (a.reverse) std::swap(fg, bg);
+        if (bg != Qt::black)
+            p.fillRect(x * charW, y * charH, (end - x) * charW, charH, bg);
+
+        int style = (a.bold ? GlyphAtlas::Bold : 0) | (a.underline ? GlyphAtlas::Underline : 0);
+        if (atlasEnabled) {
+            for (int i = x; i < end; ++i)
+                if (line[i].c != L' ' || a.underline)
+                    glyphs.draw(p, i * charW, y * charH, uint(line[i].c), style, fg.rgb());
+            return;
+        }
+
+        QVector<uint> text(end - x);
+        bool blank = !a.underline;
+        for (int i = x; i < end; ++i) {
+            text[i - x] = uint(line[i].c);
+            blank = blank && line[i].c == L' ';
+        }
+        if (blank) return;
+        QFont f = font();
+        f.setBold(a.bold);
+        f.setUnderline(a.underline);
+        p.setFont(f);
+        p.setPen(fg);
+        p.drawText(x * charW, (y + 1) * charH - baseline, QString::fromUcs4(text.constData(), text.size()));
     }
 
     void initPTY() {
@@ -113,34 +494,249 @@ private:
         fcntl(masterFd, F_SETFL, O_NONBLOCK);
     }
 
-    static void tmtCallback(tmt_msg_t m, TMT *vt, const void *, void *u) {
-        if (m == TMT_MSG_SCREEN) static_cast<TerminalWidget*>(u)->update();
+    static QColor tmtColor(int c, QColor def) {
+        static const QColor palette[] = {
+            Qt::black, Qt::red, Qt::green, Qt::yellow,
+            Qt::blue, Qt::magenta, Qt::cyan, Qt::white
+        };
+        return (c >= TMT_COLOR_BLACK && c < TMT_COLOR_MAX) ? palette[c - TMT_COLOR_BLACK] : def;
+    }
+
+    // Runs on whichever thread owns vt; with threaded parsing the worker's
+    // frame callback schedules the repaint instead.
+    static void tmtCallback(tmt_msg_t m, TMT *v, const void *a, void *u) {
+        TerminalWidget *w = static_cast<TerminalWidget*>(u);
+        switch (m) {
+            case TMT_MSG_UPDATE:
+                w->collectDirtyLines(v); // vt is not assigned yet during tmt_open()
+                w->flushDamage();
+                break;
+            case TMT_MSG_MOVED: {
+                int r = int(static_cast<const TMTPOINT *>(a)->r);
+                w->rowDamage += QRect(0, w->cursorRow, 1, 1);
+                w->rowDamage += QRect(0, r, 1, 1);
+                w->cursorRow = r;
+                w->flushDamage();
+                break;
+            }
+            case TMT_MSG_CURSOR:
+                w->cursorShown = static_cast<const char *>(a)[0] == 't';
+                w->rowDamage += QRect(0, w->cursorRow, 1, 1);
+                w->flushDamage();
+                break;
+            case TMT_MSG_SCROLL:
+                w->scrollRows(static_cast<const TMTSCROLL *>(a));
+                break;
+            case TMT_MSG_SCROLLBACK:
+                w->pushScrollback(static_cast<const TMTLINE *>(a), tmt_screen(v)->ncol);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void pushScrollback(const TMTLINE *l, size_t ncol) {
+        pushedLine.resize(int(ncol));
+        for (size_t i = 0; i < ncol; ++i) {
+            const TMTATTRS &a = l->chars[i].a;
+            int attrs = (a.bold ? PackedCell::Bold : 0) | (a.underline ? PackedCell::Underline : 0)
+                      | (a.reverse ? PackedCell::Inverse : 0);
+            pushedLine[int(i)] = PackedCell::make(uint(l->chars[i].c), attrs, cellColor(a.fg), cellColor(a.bg));
+        }
+        QMutexLocker lock(&scrollbackLock);
+        scrollback.push(pushedLine.constData(), int(ncol));
+    }
+
+    static quint32 cellColor(int c) {
+        return (c >= TMT_COLOR_BLACK && c < TMT_COLOR_MAX) ? CellColor::indexed(c - TMT_COLOR_BLACK) : CellColor::Default;
+    }
+
+    static tmt_color_t tmtColorOf(quint32 c) {
+        return (c & CellColor::KindMask) == CellColor::Indexed ? tmt_color_t(TMT_COLOR_BLACK + (c & 7)) : TMT_COLOR_DEFAULT;
+    }
+
+    // Turn TMT's dirty lines into row spans and mark the screen clean.
+    void collectDirtyLines(TMT *v) {
+        const TMTSCREEN *s = tmt_screen(v);
+        size_t y = 0;
+        while (y < s->nline) {
+            if (!s->lines[y]->dirty) { ++y; continue; }
+            size_t e = y + 1;
+            while (e < s->nline && s->lines[e]->dirty) ++e;
+            rowDamage += QRect(0, int(y), 1, int(e - y));
+            y = e;
+        }
+        tmt_clean(v);
+    }
+
+    // TMT leaves scrolled lines clean; blit them instead of repainting.
+    // With threaded parsing the GUI may skip frames, so there is no painted
+    // state to blit from and the whole region is damaged instead; the same
+    // goes for a scrolled-back view, where the screen sits lower.
+    void scrollRows(const TMTSCROLL *s) {
+        counters.add(PerfCounters::LinesScrolled, quint64(qAbs(s->n)));
+        QRect area(0, int(s->top), 1, int(s->bottom - s->top + 1));
+        if (worker || !history.isLive()) {
+            rowDamage += area;
+            return;
+        }
+        rowDamage += QRect(0, cursorRow, 1, 1); // the cursor is blitted along
+        flushDamage();
+        frameScheduler.requestScroll(rowsToPixels(area).boundingRect(), 0, -s->n * charH);
+    }
+
+    // Direct mode: repaint the damaged rows. With threaded parsing the
+    // damage travels with the next published frame instead.
+    void flushDamage() {
+        if (worker || rowDamage.isEmpty()) return;
+        frameScheduler.requestFrame(rowsToPixels(rowDamage));
+        rowDamage = QRegion();
+    }
+
+    // Screen rows to widget pixels, below the history rows if scrolled back.
+    QRegion rowsToPixels(const QRegion &rowRegion) const {
+        QRegion px;
+        int top = history.offset();
+        for (const QRect &r : rowRegion)
+            px += QRect(0, (r.top() + top) * charH, scrollBar->x(), r.height() * charH);
+        return px;
     }
 
     void initTMT() {
         vt = tmt_open(rows, cols, tmtCallback, this, nullptr);
+        if (vt)
+            tmt_set_scroll_notify(vt, true);
     }
 
-    void startTimer() {
-        QTimer *timer = new QTimer(this);
-        connect(timer, &QTimer::timeout, this, &TerminalWidget::readPTY);
-        timer->start(10);
+    void startReadNotifier() {
+        if (masterFd < 0) return;
+        readNotifier = new QSocketNotifier(masterFd, QSocketNotifier::Read, this);
+        connect(readNotifier, &QSocketNotifier::activated, this, &TerminalWidget::readPTY);
+        writer = new PtyWriter(masterFd);
+        writer->setWrittenCallback([this]() { latency.written(); });
     }
 
     void readPTY() {
-        char buf[4096];
-        int n = read(masterFd, buf, sizeof(buf));
-        if (n > 0) tmt_write(vt, buf, n);
+        char *buf = readBuffer.data();
+        int total = 0;
+        qint64 start = counters.now();
+        while (total < budget) {
+            ssize_t n = read(masterFd, buf, qMin(readBuffer.size(), budget - total));
+            if (n > 0) {
+                latency.outputRead();
+                counters.read(n);
+                counters.parsed(buf, size_t(n));
+                tmt_write(vt, buf, n);
+                total += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0 || errno != EAGAIN) readNotifier->setEnabled(false);
+            break;
+        }
+        lastFrameBytes = total;
+        if (total > 0) {
+            latency.parsed();
+            counters.span("parse", start, counters.now(), total);
+            syncHistory();
+            emit outputConsumed(total);
+        }
+    }
+
+    void drainReader() {
+        if (!reader) return;
+        SpscByteRing &ring = reader->ring();
+        int total = 0;
+        qint64 start = counters.now();
+        while (total < budget) {
+            size_t len;
+            const char *data = ring.readSpan(&len);
+            if (!len) break;
+            len = qMin(len, size_t(budget - total));
+            counters.parsed(data, len);
+            tmt_write(vt, data, len);
+            ring.commitRead(len);
+            total += int(len);
+        }
+        reader->acknowledge();
+        lastFrameBytes = total;
+        if (total > 0) {
+            latency.parsed();
+            counters.span("parse", start, counters.now(), total);
+            syncHistory();
+            emit outputConsumed(total);
+        }
+    }
+
+    // Worker thread: copy the screen into the back buffer and publish it.
+    void publishFrame() {
+        qint64 start = counters.now();
+        const TMTSCREEN *s = tmt_screen(vt);
+        Frame &f = frames.back();
+        f.rows = int(s->nline);
+        f.cols = int(s->ncol);
+        f.cells.resize(f.rows * f.cols);
+        TMTCHAR *dst = f.cells.data();
+        for (int y = 0; y < f.rows; ++y)
+            memcpy(dst + y * f.cols, s->lines[y]->chars, f.cols * sizeof(TMTCHAR));
+        f.cursor = *tmt_cursor(vt);
+        f.cursorVisible = cursorShown;
+        {
+            QMutexLocker lock(&scrollbackLock);
+            f.historyFirst = scrollback.droppedLines();
+            f.historyLines = scrollback.lineCount();
+        }
+
+        // Damage and frame are handed over together, so the GUI never
+        // takes damage for a frame it cannot acquire yet.
+        QMutexLocker lock(&damageLock);
+        publishedDamage += rowDamage;
+        rowDamage = QRegion();
+        if (frames.publish())
+            counters.add(PerfCounters::FramesDropped);
+        counters.span("publish", start, counters.now());
+    }
+
+    // GUI thread.
+    void presentFrame() {
+        framePosted = false;
+        QRegion damage;
+        {
+            QMutexLocker lock(&damageLock);
+            if (!worker || !frames.acquire()) return;
+            damage = publishedDamage;
+            publishedDamage = QRegion();
+        }
+        latency.parsed();   // the frame is now on the GUI thread
+        syncHistory();
+        frameScheduler.requestFrame(rowsToPixels(damage));
     }
 };
 
 int main(int argc, char *argv[]) {
     QApplication a(argc, argv);
     TerminalWidget w;
+    if (a.arguments().contains("--render-benchmark")) {
+        QByteArray json = w.renderBenchmark();
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+        return 0;
+    }
+    if (qEnvironmentVariableIsSet("QTERM_THREADED_READS")) w.setThreadedReads(true);
+    if (qEnvironmentVariableIsSet("QTERM_THREADED_PARSING")) w.setThreadedParsing(true);
+    if (qEnvironmentVariableIsSet("QTERM_LATENCY_PROBE"))
+        w.setLatencyProbeEnabled(true);
+    if (qEnvironmentVariableIsSet("QTERM_PERF_COUNTERS"))
+        w.perfCounters().setEnabled(true);
+    if (qEnvironmentVariableIsSet("QTERM_TRACE"))
+        w.setTraceFile(qEnvironmentVariable("QTERM_TRACE"));
+    if (qEnvironmentVariableIsSet("QTERM_SCROLLBACK_FILE")) {
+        QString path = qEnvironmentVariable("QTERM_SCROLLBACK_FILE");
+        w.setScrollbackFile(path.isEmpty() ? Scrollback::defaultSpillPath() : path, !path.isEmpty());
+    }
     w.setWindowTitle("libtmt-revival Qt Terminal");
     w.resize(800, 450);
     w.show();
     return a.exec();
 }
 
-#include "qt_tmt_terminal.moc"
+#include "main.moc"
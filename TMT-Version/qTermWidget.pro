@@ -15,10 +15,29 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Bitfield TMTATTRS: 8-byte instead of 20-byte cells (see tmt.h).
+DEFINES += TMT_PACKED_CELLS
+
 SOURCES += \
-    main.cpp
+    main.cpp \
+    tmt.c
 
 HEADERS += \
+    tmt.h \
+    ../common/cellgrid.h \
+    ../common/framescheduler.h \
+    ../common/glyphatlas.h \
+    ../common/historyview.h \
+    ../common/latencyprobe.h \
+    ../common/parserworker.h \
+    ../common/perfcounters.h \
+    ../common/ptyreader.h \
+    ../common/ptywriter.h \
+    ../common/renderbench.h \
+    ../common/scrollback.h \
+    ../common/spscring.h \
+    ../common/triplebuffer.h \
+    ../common/utf8.h
 
 FORMS += \
 
@@ -32,5 +51,5 @@ RESOURCES +=
 
 LIBS += -L/Users/macbook2015/Desktop/brew/lib -lvterm
 
-INCLUDEPATH += /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib /Users/macbook2015/Desktop/brew/Cellar/libvterm/0.3.3/include
+INCLUDEPATH += $$PWD/../common /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib /Users/macbook2015/Desktop/brew/Cellar/libvterm/0.3.3/include
 
@@ -29,7 +29,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "tmt.h"
+#include "utf8.h"
 
 #define BUF_MAX 100
 #define PAR_MAX 8
@@ -89,6 +94,11 @@ struct TMT{
 
     bool dirty, acs, ignored;
     TMTSCREEN screen;
+    // screen.lines is a window of nline slots into ring, which holds every
+    // line pointer twice (ring[i] == ring[i + nline]). Scrolling the whole
+    // screen just moves the window; see rotate().
+    TMTLINE **ring;
+    size_t base;
     TMTLINE *tabs;
 
     TMTCALLBACK cb;
@@ -99,10 +109,9 @@ struct TMT{
     int xlate[2]; // What's in the charset?  0=ASCII, 1=DEC Special Graphics
 
     bool decode_unicode; // Try to decode characters to ACS equivalents?
+    bool scroll_notify;  // Report scrolls with TMT_MSG_SCROLL instead of dirtying lines?
 
-    mbstate_t ms;
-    size_t nmb;
-    char mb[BUF_MAX + 1];
+    utf8_decoder utf8;
 
     char title[TITLE_MAX + 1];
     size_t ntitle;
@@ -125,6 +134,14 @@ tmt_set_unicode_decode(TMT *vt, bool v)
     return r;
 }
 
+bool
+tmt_set_scroll_notify(TMT *vt, bool v)
+{
+    bool r = vt->scroll_notify;
+    vt->scroll_notify = v;
+    return r;
+}
+
 static wchar_t
 tacs(const TMT *vt, unsigned char c)
 {
@@ -165,13 +182,62 @@ clearlines(TMT *vt, size_t r, size_t n)
         clearline(vt, vt->screen.lines[i], 0, vt->screen.ncol);
 }
 
+static void
+scrolled(TMT *vt, size_t r, ssize_t n)
+{
+    // With scroll notification the moved lines stay clean: the client shifts
+    // what it already drew, and only the cleared lines are reported dirty.
+    if (vt->scroll_notify){
+        TMTSCROLL s = {r, vt->maxline, (int)n};
+        vt->dirty = true;
+        CB(vt, TMT_MSG_SCROLL, &s);
+    } else
+        dirtylines(vt, r, vt->maxline+1);
+}
+
+static bool
+wholescreen(const TMT *vt, size_t r)
+{
+    return r == 0 && vt->maxline == vt->screen.nline - 1;
+}
+
+static void
+rotate(TMT *vt, ssize_t n)
+{
+    // Lines 0..nline-1 move up by n (down if negative); as the ring is
+    // mirrored, that is only a new window base.
+    size_t nline = vt->screen.nline;
+    vt->base = (vt->base + nline + n) % nline;
+    vt->screen.lines = vt->ring + vt->base;
+}
+
+static void
+syncring(TMT *vt, size_t s, size_t e)
+{
+    // Copy lines s..e-1 of the window to their mirror slots.
+    size_t nline = vt->screen.nline;
+    for (size_t i = s; i < e; i++){
+        size_t p = vt->base + i;
+        vt->ring[p < nline? p + nline : p - nline] = vt->ring[p];
+    }
+}
+
 static void
 scrup(TMT *vt, size_t r, ssize_t n)
 {
+    // Only lines scrolled off the top of the screen go to the scrollback,
+    // not ones deleted with DL or scrolled out of a lower region.
+    bool save = r == SCR_DEF && vt->minline == 0;
     if (r == SCR_DEF) r = vt->minline;
+    if (r > vt->maxline) return; // DL below the scrolling region
     n = MIN(n, vt->maxline - r);
 
-    if (n>0){
+    for (ssize_t i = 0; save && i < n; i++)
+        CB(vt, TMT_MSG_SCROLLBACK, vt->screen.lines[i]);
+
+    if (n>0 && wholescreen(vt, r))
+        rotate(vt, n);
+    else if (n>0){
         TMTLINE *buf[n];
 
         memcpy(buf, vt->screen.lines + r, n * sizeof(TMTLINE *));
@@ -179,9 +245,12 @@ scrup(TMT *vt, size_t r, ssize_t n)
                 (vt->maxline - n - r + 1) * sizeof(TMTLINE *));
         memcpy(vt->screen.lines + (vt->maxline - n + 1),
                buf, n * sizeof(TMTLINE *));
+        syncring(vt, r, vt->maxline + 1);
+    }
 
+    if (n>0){
         clearlines(vt, vt->maxline - n + 1, n);
-        dirtylines(vt, r, vt->maxline+1);
+        scrolled(vt, r, n);
     }
 }
 
@@ -189,9 +258,12 @@ static void
 scrdn(TMT *vt, size_t r, ssize_t n)
 {
     if (r == SCR_DEF) r = vt->minline;
+    if (r > vt->maxline) return; // IL below the scrolling region
     n = MIN(n, vt->maxline - r);
 
-    if (n>0){
+    if (n>0 && wholescreen(vt, r))
+        rotate(vt, -n);
+    else if (n>0){
         TMTLINE *buf[n];
 
         memcpy(buf, vt->screen.lines + (vt->maxline - n + 1),
@@ -199,9 +271,12 @@ scrdn(TMT *vt, size_t r, ssize_t n)
         memmove(vt->screen.lines + r + n, vt->screen.lines + r,
                 (vt->maxline - n - r + 1) * sizeof(TMTLINE *));
         memcpy(vt->screen.lines + r, buf, n * sizeof(TMTLINE *));
+        syncring(vt, r, vt->maxline + 1);
+    }
 
+    if (n>0){
         clearlines(vt, r, n);
-        dirtylines(vt, r, vt->maxline+1);
+        scrolled(vt, r, -n);
     }
 }
 
@@ -257,7 +332,7 @@ HANDLER(el)
 }
 
 HANDLER(sgr)
-    #define FGBG(c) *(P0(i) < 40? &vt->attrs.fg : &vt->attrs.bg) = c
+    #define FGBG(c) (P0(i) < 40? (vt->attrs.fg = c) : (vt->attrs.bg = c))
     for (size_t i = 0; i < vt->npar; i++) switch (P0(i)){
         case  0: vt->attrs                    = defattrs;   break;
         case  1: case 22: vt->attrs.bold      = P0(i) < 20; break;
@@ -418,11 +493,21 @@ xtversion(TMT *vt)
     CB(vt, TMT_MSG_ANSWER, buf);
 }
 
+#ifdef TMT_REFERENCE_PARSER
+/* The original parser: a chain of state compares and strchr() calls per
+ * byte. The table-driven parser below is built from the same rules, and
+ * bench/tmtDiff.pro builds this one next to it and diffs the two on random
+ * streams; a rule changed here or in the table must change in both. The
+ * only deliberate edit is ignoring NUL.
+ */
 static bool
 handlechar(TMT *vt, char i)
 {
     COMMON_VARS;
 
+    // strchr() would match NUL against the terminator of every set.
+    if (!i) return true;
+
     char cs[] = {i, 0};
     #define ON(S, C, A) if (vt->state == (S) && strchr(C, i)){ A; return true;}
     #define DO(S, C, A) ON(S, C, consumearg(vt); if (!vt->ignored) {A;} \
@@ -507,6 +592,173 @@ handlechar(TMT *vt, char i)
 
     return resetparser(vt), false;
 }
+#else
+
+/* Actions of the escape parser. The "ON" actions just update the parser
+ * state; the "DO" actions, from A_DO on, complete a sequence: the pending
+ * argument is consumed, the action runs unless the sequence is ignored, and
+ * the parser is reset.
+ */
+enum{
+    A_NONE,
+    A_IGNORE, A_ESC, A_ESC_IGNORED, A_CSI, A_OSC, A_SEMI, A_Q, A_DIGIT,
+    A_TITLE_SEMI, A_GT, A_LPAREN, A_RPAREN,
+    A_DO,
+    A_BEL = A_DO, A_BS, A_HT, A_LF, A_CR, A_SO, A_SI,
+    A_NOP, A_HTS, A_SC, A_RC, A_RIS, A_RI,
+    A_CUU, A_CUD, A_CUF, A_CUB, A_CNL, A_CPL, A_CHA, A_VPA, A_STBM, A_CUP,
+    A_CHT, A_ED, A_EL, A_IL, A_DL, A_DCH, A_SU, A_SD, A_ECH, A_CBT, A_REP,
+    A_DA, A_TBC, A_SGR, A_DSR, A_SM, A_RM, A_DA2, A_XTVERSION, A_TITLE,
+    A_ICH, A_G0ASCII, A_G0DEC, A_G1ASCII, A_G1DEC
+};
+
+#define NSTATES (S_RPAREN + 1)
+
+/* In priority order: the first rule matching a state and byte wins. */
+static const struct{
+    unsigned char state;
+    const char *chars;
+    unsigned char action;
+} rules[] = {
+    {S_NUL, "\x07", A_BEL},      {S_NUL, "\x08", A_BS},
+    {S_NUL, "\x09", A_HT},       {S_NUL, "\x0a", A_LF},
+    {S_NUL, "\x0d", A_CR},       {S_NUL, "\x0e", A_SO},
+    {S_NUL, "\x0f", A_SI},       {S_NUL, "\x1b", A_ESC},
+    {S_ESC, "\x1b", A_ESC},      {S_ESC, "=>", A_NOP},
+    {S_ESC, "H", A_HTS},         {S_ESC, "7", A_SC},
+    {S_ESC, "8", A_RC},          {S_ESC, "+*", A_ESC_IGNORED},
+    {S_ESC, "c", A_RIS},         {S_ESC, "M", A_RI},
+    {S_ESC, "[", A_CSI},         {S_ESC, "]", A_OSC},
+    {S_ARG, "\x1b", A_ESC},      {S_ARG, ";", A_SEMI},
+    {S_ARG, "?", A_Q},           {S_ARG, "0123456789", A_DIGIT},
+    {S_TITLE_ARG, "012", A_DIGIT}, {S_TITLE_ARG, ";", A_TITLE_SEMI},
+    {S_ARG, "A", A_CUU},         {S_ARG, "B", A_CUD},
+    {S_ARG, "C", A_CUF},         {S_ARG, "D", A_CUB},
+    {S_ARG, "E", A_CNL},         {S_ARG, "F", A_CPL},
+    {S_ARG, "G", A_CHA},         {S_ARG, "d", A_VPA},
+    {S_ARG, "r", A_STBM},        {S_ARG, "Hf", A_CUP},
+    {S_ARG, "I", A_CHT},         {S_ARG, "J", A_ED},
+    {S_ARG, "K", A_EL},          {S_ARG, "L", A_IL},
+    {S_ARG, "M", A_DL},          {S_ARG, "P", A_DCH},
+    {S_ARG, "S", A_SU},          {S_ARG, "T", A_SD},
+    {S_ARG, "X", A_ECH},         {S_ARG, "Z", A_CBT},
+    {S_ARG, "b", A_REP},         {S_ARG, "c", A_DA},
+    {S_ARG, "g", A_TBC},         {S_ARG, "m", A_SGR},
+    {S_ARG, "n", A_DSR},         {S_ARG, "h", A_SM},
+    {S_ARG, "l", A_RM},          {S_ARG, "i", A_NOP},
+    {S_ARG, "s", A_SC},          {S_ARG, "u", A_RC},
+    {S_ARG, ">", A_GT},
+    {S_GT_ARG, "c", A_DA2},      {S_GT_ARG, "q", A_XTVERSION},
+    {S_TITLE, "\a", A_TITLE},    {S_ARG, "@", A_ICH},
+    {S_ESC, "(", A_LPAREN},      {S_ESC, ")", A_RPAREN},
+    {S_LPAREN, "AB12", A_G0ASCII}, {S_LPAREN, "0", A_G0DEC},
+    {S_RPAREN, "AB12", A_G1ASCII}, {S_RPAREN, "0", A_G1DEC},
+};
+
+static unsigned char actions[NSTATES][256];
+static pthread_once_t actions_once = PTHREAD_ONCE_INIT;
+
+static void
+buildactions(void)
+{
+    for (size_t r = sizeof(rules) / sizeof(rules[0]); r-- > 0; )
+        for (const char *p = rules[r].chars; *p; p++)
+            actions[rules[r].state][(unsigned char)*p] = rules[r].action;
+    for (int st = 0; st < NSTATES; st++)
+        actions[st][0] = A_IGNORE;
+}
+
+static bool
+handlechar(TMT *vt, char i)
+{
+    COMMON_VARS;
+
+    unsigned char a = actions[vt->state][(unsigned char)i];
+    if (a >= A_DO){
+        consumearg(vt);
+        if (!vt->ignored) switch (a){
+            case A_BEL:  CB(vt, TMT_MSG_BELL, NULL);                         break;
+            case A_BS:   if (c->c) c->c--;                                   break;
+            case A_HT:   while (++c->c < s->ncol - 1 && t[c->c].c != L'*');  break;
+            case A_LF:   nl(vt);                                             break;
+            case A_CR:   cr(vt);                                             break;
+            case A_SO:   vt->charset = 1;                                    break;
+            case A_SI:   vt->charset = 0;                                    break;
+            case A_NOP:                                                      break;
+            case A_HTS:  t[c->c].c = L'*';                                   break;
+            case A_SC:   vt->oldcurs = vt->curs; vt->oldattrs = vt->attrs;   break;
+            case A_RC:   vt->curs = vt->oldcurs; vt->attrs = vt->oldattrs;   break;
+            case A_RIS:  tmt_reset(vt);                                      break;
+            case A_RI:   reverse_nl(vt);                                     break;
+            case A_CUU:  c->r = MAX(c->r - P1(0), 0);                        break;
+            case A_CUD:  c->r = MIN(c->r + P1(0), s->nline - 1);             break;
+            case A_CUF:  c->c = MIN(c->c + P1(0), s->ncol - 1);              break;
+            case A_CUB:  c->c = MIN(c->c - P1(0), c->c);                     break;
+            case A_CNL:  c->c = 0; c->r = MIN(c->r + P1(0), s->nline - 1);   break;
+            case A_CPL:  c->c = 0; c->r = MAX(c->r - P1(0), 0);              break;
+            case A_CHA:  c->c = MIN(P1(0) - 1, s->ncol - 1);                 break;
+            case A_VPA:  c->r = MIN(P1(0) - 1, s->nline - 1);                break;
+            case A_STBM: margin(vt, P1(0)-1, P1(1)-1);                       break;
+            case A_CUP:  c->r = P1(0) - 1; c->c = P1(1) - 1;                 break;
+            case A_CHT:  while (++c->c < s->ncol - 1 && t[c->c].c != L'*');  break;
+            case A_ED:   ed(vt);                                             break;
+            case A_EL:   el(vt);                                             break;
+            case A_IL:   scrdn(vt, c->r, P1(0));                             break;
+            case A_DL:   scrup(vt, c->r, P1(0));                             break;
+            case A_DCH:  dch(vt);                                            break;
+            case A_SU:   scrup(vt, SCR_DEF, P1(0));                          break;
+            case A_SD:   scrdn(vt, SCR_DEF, P1(0));                          break;
+            case A_ECH:  clearline(vt, l, c->c, c->c+P1(0));                 break;
+            case A_CBT:  while (c->c && t[--c->c].c != L'*');                break;
+            case A_REP:  rep(vt);                                            break;
+            case A_DA:   if (!vt->q) CB(vt, TMT_MSG_ANSWER, "\033[?6c");     break;
+            case A_TBC:  if (P0(0) == 3) clearline(vt, vt->tabs, 0, s->ncol); break;
+            case A_SGR:  sgr(vt);                                            break;
+            case A_DSR:  if (P0(0) == 6) dsr(vt);                            break;
+            case A_SM:   sm(vt);                                             break;
+            case A_RM:   rm(vt);                                             break;
+            case A_DA2:  CB(vt, TMT_MSG_ANSWER, "\033[>0;95c");              break;
+            case A_XTVERSION: xtversion(vt);                                 break;
+            case A_TITLE: title(vt);                                         break;
+            case A_ICH:  ich(vt);                                            break;
+            case A_G0ASCII: vt->xlate[0] = 0;                                break;
+            case A_G0DEC:   vt->xlate[0] = 1;                                break;
+            case A_G1ASCII: vt->xlate[1] = 0;                                break;
+            case A_G1DEC:   vt->xlate[1] = 1;                                break;
+        }
+        fixcursor(vt);
+        resetparser(vt);
+        return true;
+    }
+
+    switch (a){
+        case A_IGNORE:                                              return true;
+        case A_ESC:         vt->state = S_ESC;                      return true;
+        case A_ESC_IGNORED: vt->ignored = true; vt->state = S_ARG;  return true;
+        case A_CSI:         vt->state = S_ARG;                      return true;
+        case A_OSC:         vt->state = S_TITLE_ARG;                return true;
+        case A_SEMI:        consumearg(vt);                         return true;
+        case A_Q:           vt->q = 1;                              return true;
+        case A_DIGIT:       vt->arg = vt->arg * 10 + (i - '0');     return true;
+        case A_TITLE_SEMI:  consumearg(vt); vt->state = S_TITLE;    return true;
+        case A_GT:          vt->state = S_GT_ARG;                   return true;
+        case A_LPAREN:      vt->state = S_LPAREN;                   return true;
+        case A_RPAREN:      vt->state = S_RPAREN;                   return true;
+    }
+
+    if (vt->state == S_TITLE)
+    {
+        if ( (i >= 32) && (vt->ntitle < TITLE_MAX) )
+        {
+            vt->title[vt->ntitle] = i;
+            vt->ntitle += 1;
+            return true;
+         }
+    }
+
+    return resetparser(vt), false;
+}
+#endif
 
 static void
 notify(TMT *vt, bool update, bool moved)
@@ -532,7 +784,7 @@ freelines(TMT *vt, size_t s, size_t n, bool screen)
         free(vt->screen.lines[i]);
         vt->screen.lines[i] = NULL;
     }
-    if (screen) free(vt->screen.lines);
+    if (screen) free(vt->ring);
 }
 
 TMT *
@@ -542,6 +794,10 @@ tmt_open(size_t nline, size_t ncol, TMTCALLBACK cb, void *p,
     TMT *vt = calloc(1, sizeof(TMT));
     if (!nline || !ncol || !vt) return free(vt), NULL;
 
+#ifndef TMT_REFERENCE_PARSER
+    pthread_once(&actions_once, buildactions);
+#endif
+
     /* ASCII-safe defaults for box-drawing characters. */
     vt->acschars = acs? acs : L"><^v#+:o##+++++~---_++++|<>*!fo";
     vt->cb = cb;
@@ -566,11 +822,16 @@ tmt_resize(TMT *vt, size_t nline, size_t ncol)
     if (nline < vt->screen.nline)
         freelines(vt, nline, vt->screen.nline - nline, false);
 
-    TMTLINE **l = realloc(vt->screen.lines, nline * sizeof(TMTLINE *));
+    // The new ring starts unrotated, with the kept lines in screen order.
+    TMTLINE **l = calloc(2 * nline, sizeof(TMTLINE *));
     if (!l) return false;
+    if (vt->ring)
+        memcpy(l, vt->screen.lines, MIN(nline, vt->screen.nline) * sizeof(TMTLINE *));
+    free(vt->ring);
 
     size_t pc = vt->screen.ncol;
-    vt->screen.lines = l;
+    vt->ring = vt->screen.lines = l;
+    vt->base = 0;
     vt->screen.ncol = ncol;
     for (size_t i = 0; i < nline; i++){
         TMTLINE *nl = NULL;
@@ -580,7 +841,7 @@ tmt_resize(TMT *vt, size_t nline, size_t ncol)
             nl = allocline(vt, vt->screen.lines[i], ncol, pc);
 
         if (!nl) return false;
-        vt->screen.lines[i] = nl;
+        vt->screen.lines[i] = l[i + nline] = nl;
     }
     vt->screen.nline = nline;
 
@@ -706,20 +967,139 @@ writecharatcurs(TMT *vt, wchar_t w)
     }
 }
 
+/* Length of the run of bytes at the start of s that add rotates onto the
+ * top of the signed byte range, above lim. One signed compare per byte then
+ * finds the end of the run.
+ */
+static size_t
+byterun(const char *s, size_t n, char add, signed char lim)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i add32 = _mm256_set1_epi8(add), lim32 = _mm256_set1_epi8(lim);
+    for (; i + 32 <= n; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(
+            _mm256_cmpgt_epi8(_mm256_add_epi8(v, add32), lim32));
+        if (m != 0xffffffffu) return i + __builtin_ctz(~m);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i add16 = _mm_set1_epi8(add), lim16 = _mm_set1_epi8(lim);
+    for (; i + 16 <= n; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(
+            _mm_cmpgt_epi8(_mm_add_epi8(v, add16), lim16));
+        if (m != 0xffffu) return i + __builtin_ctz(~m);
+    }
+#endif
+    while (i < n && (signed char)(s[i] + add) > lim)
+        i++;
+    return i;
+}
+
+/* Printable ASCII, 0x20-0x7e: adding 1 maps it onto 0x21-0x7f. */
 static inline size_t
-testmbchar(TMT *vt)
+printablerun(const char *s, size_t n)
 {
-    mbstate_t ts = vt->ms;
-    return vt->nmb? mbrtowc(NULL, vt->mb, vt->nmb, &ts) : (size_t)-2;
+    return byterun(s, n, 0x01, 0x20);
+}
+
+/* Everything but C0 controls, 0x20-0xff: flipping the top bit maps it onto
+ * -96..127.
+ */
+static inline size_t
+textrun(const char *s, size_t n)
+{
+    return byterun(s, n, (char)0x80, -97);
 }
 
 static inline wchar_t
-getmbchar(TMT *vt)
+decoded(uint32_t c)
 {
-    wchar_t c = 0;
-    size_t n = mbrtowc(&c, vt->mb, vt->nmb, &vt->ms);
-    vt->nmb = 0;
-    return (n == (size_t)-1 || n == (size_t)-2)? TMT_INVALID_CHAR : c;
+    return c == UTF8_REPLACEMENT? TMT_INVALID_CHAR : (wchar_t)c;
+}
+
+static void
+decodebyte(TMT *vt, unsigned char b)
+{
+    int again;
+    do{
+        uint32_t c = utf8_step(&vt->utf8, b, &again);
+        if (c != UTF8_NEED_MORE)
+            writecharatcurs(vt, decoded(c));
+    } while (again);
+}
+
+/* writecharatcurs() for a run of printable ASCII, a line segment at a time.
+ * Only valid when none of the per-character translations apply: see the
+ * conditions in tmt_write().
+ */
+static void
+writeascii(TMT *vt, const char *s, size_t n)
+{
+    TMTPOINT *c = &vt->curs;
+    size_t ncol = vt->screen.ncol;
+
+    while (n){
+        if (vt->hang == 2)
+            scrup(vt, SCR_DEF, 1);
+        vt->hang = 0;
+
+        TMTLINE *l = CLINE(vt);
+        size_t m = MIN(n, ncol - c->c);
+        TMTCHAR *d = l->chars + c->c;
+        for (size_t i = 0; i < m; i++){
+            d[i].c = (wchar_t)s[i];
+            d[i].a = vt->attrs;
+        }
+        l->dirty = vt->dirty = true;
+        s += m;
+        n -= m;
+
+        if (c->c + m < ncol)
+            c->c += m;
+        else{
+            vt->hang = 1;
+            c->c = 0;
+            c->r++;
+            if (c->r > vt->maxline){
+                c->r = vt->maxline;
+                vt->hang = 2;
+            }
+        }
+    }
+}
+
+/* A run of non-control bytes in ground state: printable ASCII goes through
+ * writeascii(), anything else is decoded in bulk up to the next ASCII.
+ */
+static void
+writetext(TMT *vt, const char *s, size_t n)
+{
+    uint32_t buf[256];
+
+    while (n){
+        bool plain = !vt->xlate[vt->charset];
+        if (plain && utf8_idle(&vt->utf8)){
+            size_t k = printablerun(s, n);
+            if (k){
+                writeascii(vt, s, k);
+                s += k;
+                n -= k;
+                continue;
+            }
+        }
+
+        size_t m = plain? 1 : n;
+        while (m < n && (unsigned char)s[m] >= 0x80)
+            m++;
+        size_t used, got = utf8_decode(&vt->utf8, s, m, buf, sizeof(buf) / sizeof(buf[0]), &used);
+        for (size_t i = 0; i < got; i++)
+            writecharatcurs(vt, decoded(buf[i]));
+        s += used;
+        n -= used;
+    }
 }
 
 void
@@ -729,21 +1109,30 @@ tmt_write(TMT *vt, const char *s, size_t n)
     n = n? n : strlen(s);
 
     for (size_t p = 0; p < n; p++){
-        if (handlechar(vt, s[p]))
-            vt->hang = 0;
-        else if (vt->acs)
-            writecharatcurs(vt, tacs(vt, (unsigned char)s[p]));
-        else if (vt->nmb >= BUF_MAX)
-            writecharatcurs(vt, getmbchar(vt));
-        else{
-            switch (testmbchar(vt)){
-                case (size_t)-1: writecharatcurs(vt, getmbchar(vt)); break;
-                case (size_t)-2: vt->mb[vt->nmb++] = s[p];           break;
+        // Text outside escape sequences never needs handlechar(): in
+        // ground state no byte from 0x20 up starts or continues one.
+        if (vt->state == S_NUL && !vt->acs){
+            size_t k = textrun(s + p, n - p);
+            if (k){
+                writetext(vt, s + p, k);
+                p += k - 1;
+                continue;
             }
+        }
 
-            if (testmbchar(vt) <= MB_LEN_MAX)
-                writecharatcurs(vt, getmbchar(vt));
+        unsigned char b = (unsigned char)s[p];
+        if (b < 0x80 && !utf8_idle(&vt->utf8)){
+            // An ASCII byte cuts a multibyte character short.
+            utf8_init(&vt->utf8);
+            writecharatcurs(vt, TMT_INVALID_CHAR);
         }
+
+        if (handlechar(vt, s[p]))
+            vt->hang = 0;
+        else if (vt->acs)
+            writecharatcurs(vt, tacs(vt, b));
+        else
+            decodebyte(vt, b);
     }
 
     notify(vt, vt->dirty, memcmp(&oc, &vt->curs, sizeof(oc)) != 0);
@@ -774,7 +1163,7 @@ tmt_reset(TMT *vt)
     memset(vt, 0, sizeof(vt));
     resetparser(vt);
     vt->attrs = vt->oldattrs = defattrs;
-    memset(&vt->ms, 0, sizeof(vt->ms));
+    utf8_init(&vt->utf8);
     clearlines(vt, 0, vt->screen.nline);
     CB(vt, TMT_MSG_CURSOR, "t");
     notify(vt, true, true);
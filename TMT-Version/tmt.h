@@ -80,7 +80,25 @@ typedef enum{
     TMT_COLOR_MAX
 } tmt_color_t;
 
+/* Define TMT_PACKED_CELLS to store the attributes as bitfields: TMTATTRS
+ * shrinks from 16 bytes to 4 and TMTCHAR from 20 to 8 (with a 4-byte
+ * wchar_t). Field names and value ranges are unchanged, so code that reads
+ * and assigns them compiles either way; only taking a field's address does
+ * not.
+ */
 typedef struct TMTATTRS TMTATTRS;
+#ifdef TMT_PACKED_CELLS
+struct TMTATTRS{
+    bool bold : 1;
+    bool dim : 1;
+    bool underline : 1;
+    bool blink : 1;
+    bool reverse : 1;
+    bool invisible : 1;
+    signed int fg : 5;  /* tmt_color_t */
+    signed int bg : 5;  /* tmt_color_t */
+};
+#else
 struct TMTATTRS{
     bool bold;
     bool dim;
@@ -91,6 +109,7 @@ struct TMTATTRS{
     tmt_color_t fg;
     tmt_color_t bg;
 };
+#endif
 
 typedef struct TMTCHAR TMTCHAR;
 struct TMTCHAR{
@@ -118,6 +137,15 @@ struct TMTSCREEN{
     TMTLINE **lines;
 };
 
+/* Argument of TMT_MSG_SCROLL: lines top..bottom (inclusive) moved up by n
+ * lines, or down by -n when n is negative. */
+typedef struct TMTSCROLL TMTSCROLL;
+struct TMTSCROLL{
+    size_t top;
+    size_t bottom;
+    int n;
+};
+
 /**** CALLBACK SUPPORT */
 typedef enum{
     TMT_MSG_MOVED,
@@ -128,14 +156,22 @@ typedef enum{
     TMT_MSG_CURSOR,
     TMT_MSG_SETMODE,
     TMT_MSG_UNSETMODE,
+    TMT_MSG_SCROLL,
+    TMT_MSG_SCROLLBACK,
 } tmt_msg_t;
 
+/* TMT_MSG_SCROLLBACK is sent with the (const TMTLINE *) about to scroll off
+ * the top of the screen, once per line, before it is cleared for reuse.
+ * The line has tmt_screen()->ncol cells and is only valid during the
+ * callback. */
+
 typedef void (*TMTCALLBACK)(tmt_msg_t m, struct TMT *v, const void *r, void *p);
 
 /**** PUBLIC FUNCTIONS */
 TMT *tmt_open(size_t nline, size_t ncol, TMTCALLBACK cb, void *p,
               const wchar_t *acs);
 bool tmt_set_unicode_decode(TMT *vt, bool v);
+bool tmt_set_scroll_notify(TMT *vt, bool v);
 void tmt_close(TMT *vt);
 bool tmt_resize(TMT *vt, size_t nline, size_t ncol);
 void tmt_write(TMT *vt, const char *s, size_t n);
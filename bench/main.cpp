@@ -0,0 +1,356 @@
+// qTermBench — headless throughput benchmark for the three emulation cores.
+//
+// Feeds synthetic and recorded byte streams through the hand-rolled parser
+// of the root widget (GridEmulator), libvterm as newVersion configures it
+// and tmt.c as TMT-Version builds it, without a window or a PTY, and
+// prints MB/s and ns per byte for every core and stream as JSON.
+//
+//   qTermBench [--size MiB] [--iterations n] [--core name] [--stream name]
+//              [--output file.json] [recorded-stream ...]
+//
+// Recorded streams are raw PTY output, e.g. captured with script(1) or
+// `tee` on a program's output. Each run builds a fresh core, feeds the
+// stream in READ_CHUNK pieces like the widgets' read loops do, and is
+// timed on its own; the best and the median run are reported.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVector>
+
+#include <algorithm>
+#include <stdio.h>
+
+#include "gridemulator.h"
+
+#ifndef QTERM_BENCH_NO_LIBVTERM
+#include <vterm.h>
+#endif
+
+extern "C" {
+#include "tmt.h"
+}
+
+constexpr int TERM_ROWS = 24;
+constexpr int TERM_COLS = 80;
+constexpr int READ_CHUNK = 64 * 1024;
+
+class Core {
+public:
+    virtual ~Core() {}
+    virtual void write(const char *data, size_t len) = 0;
+};
+
+class GridCore : public Core {
+public:
+    GridCore(int rows, int cols) : emulator(rows, cols) {}
+    void write(const char *data, size_t len) override { emulator.write(data, int(len)); }
+
+private:
+    GridEmulator emulator;
+};
+
+#ifndef QTERM_BENCH_NO_LIBVTERM
+class VTermCore : public Core {
+public:
+    VTermCore(int rows, int cols) {
+        vt = vterm_new(rows, cols);
+        vterm_set_utf8(vt, 1);
+        screen = vterm_obtain_screen(vt);
+        vterm_screen_set_damage_merge(screen, VTERM_DAMAGE_SCROLL);
+        vterm_screen_reset(screen, 1);
+    }
+    ~VTermCore() override { vterm_free(vt); }
+
+    // The widget flushes damage once per read batch.
+    void write(const char *data, size_t len) override {
+        vterm_input_write(vt, data, len);
+        vterm_screen_flush_damage(screen);
+    }
+
+private:
+    VTerm *vt;
+    VTermScreen *screen;
+};
+#endif
+
+class TmtCore : public Core {
+public:
+    TmtCore(int rows, int cols) { vt = tmt_open(rows, cols, callback, nullptr, nullptr); }
+    ~TmtCore() override { tmt_close(vt); }
+    void write(const char *data, size_t len) override { tmt_write(vt, data, len); }
+
+private:
+    // The widget collects the dirty lines on every update; clean them the
+    // same way so TMT does not keep redundant damage around.
+    static void callback(tmt_msg_t m, TMT *v, const void *, void *) {
+        if (m == TMT_MSG_UPDATE)
+            tmt_clean(v);
+    }
+
+    TMT *vt;
+};
+
+struct CoreInfo {
+    const char *name;
+    Core *(*make)(int rows, int cols);
+};
+
+static const CoreInfo cores[] = {
+    { "grid", [](int r, int c) -> Core * { return new GridCore(r, c); } },
+#ifndef QTERM_BENCH_NO_LIBVTERM
+    { "libvterm", [](int r, int c) -> Core * { return new VTermCore(r, c); } },
+#endif
+    { "tmt", [](int r, int c) -> Core * { return new TmtCore(r, c); } },
+};
+
+// Deterministic, so every run and every release sees the same bytes.
+class Lcg {
+public:
+    quint32 next() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return quint32(state >> 33);
+    }
+    int below(int n) { return int(next() % quint32(n)); }
+
+private:
+    quint64 state = 0x853c49e6748fea9bull;
+};
+
+static void appendWord(QByteArray &out, Lcg &rng) {
+    int len = 2 + rng.below(8);
+    for (int i = 0; i < len; ++i)
+        out += char('a' + rng.below(26));
+}
+
+// Plain text lines, as from cat or a compiler.
+static QByteArray asciiStream(int size) {
+    QByteArray out;
+    out.reserve(size + 256);
+    Lcg rng;
+    while (out.size() < size) {
+        int width = 20 + rng.below(TERM_COLS - 20);
+        int start = out.size();
+        while (out.size() - start < width) {
+            appendWord(out, rng);
+            out += ' ';
+        }
+        out += "\r\n";
+    }
+    return out;
+}
+
+// A colour change every few characters: 16, 256 and RGB colours, bold and
+// underline, as from ls --color, diffs or syntax highlighters.
+static QByteArray sgrStream(int size) {
+    QByteArray out;
+    out.reserve(size + 256);
+    Lcg rng;
+    while (out.size() < size) {
+        for (int x = 0; x < TERM_COLS;) {
+            switch (rng.below(5)) {
+            case 0: out += "\x1b[" + QByteArray::number(30 + rng.below(8)) + 'm'; break;
+            case 1: out += "\x1b[38;5;" + QByteArray::number(rng.below(256)) + 'm'; break;
+            case 2:
+                out += "\x1b[38;2;" + QByteArray::number(rng.below(256)) + ';' + QByteArray::number(rng.below(256))
+                     + ';' + QByteArray::number(rng.below(256)) + 'm';
+                break;
+            case 3: out += "\x1b[1;4;48;5;" + QByteArray::number(rng.below(256)) + 'm'; break;
+            default: out += "\x1b[0m"; break;
+            }
+            int run = 1 + rng.below(6);
+            for (int i = 0; i < run; ++i)
+                out += char('!' + rng.below(94));
+            x += run;
+        }
+        out += "\x1b[0m\r\n";
+    }
+    return out;
+}
+
+// Full-screen redraws of a cursor-addressed UI such as top or an editor:
+// home, then every row positioned, coloured, filled and erased to the end.
+static QByteArray tuiStream(int size) {
+    QByteArray out;
+    out.reserve(size + 4096);
+    Lcg rng;
+    while (out.size() < size) {
+        out += "\x1b[H";
+        for (int y = 1; y <= TERM_ROWS; ++y) {
+            out += "\x1b[" + QByteArray::number(y) + ";1H";
+            out += y == 1 ? "\x1b[7m" : "\x1b[" + QByteArray::number(31 + rng.below(7)) + 'm';
+            int width = TERM_COLS / 2 + rng.below(TERM_COLS / 2);
+            for (int x = 0; x < width; ++x)
+                out += char(' ' + rng.below(95));
+            out += "\x1b[0m\x1b[K";
+        }
+        out += "\x1b[" + QByteArray::number(TERM_ROWS) + ';' + QByteArray::number(1 + rng.below(TERM_COLS)) + 'H';
+    }
+    return out;
+}
+
+// CJK text: three-byte UTF-8 sequences with some ASCII punctuation.
+static QByteArray cjkStream(int size) {
+    QByteArray out;
+    out.reserve(size + 256);
+    Lcg rng;
+    while (out.size() < size) {
+        int glyphs = 10 + rng.below(TERM_COLS / 2 - 10);
+        for (int i = 0; i < glyphs; ++i) {
+            uint cp = rng.below(8) ? 0x4e00 + rng.below(0x5200) : 0x3041 + rng.below(0x56);
+            out += char(0xe0 | (cp >> 12));
+            out += char(0x80 | ((cp >> 6) & 0x3f));
+            out += char(0x80 | (cp & 0x3f));
+            if (!rng.below(12))
+                out += ", ";
+        }
+        out += "\r\n";
+    }
+    return out;
+}
+
+// Log lines scrolling past, as from tail -f or a build; nearly every line
+// scrolls the whole screen.
+static QByteArray scrollStream(int size) {
+    static const char *const levels[] = { "\x1b[32mINFO\x1b[0m ", "\x1b[33mWARN\x1b[0m ", "DEBUG" };
+    QByteArray out;
+    out.reserve(size + 256);
+    Lcg rng;
+    qint64 ms = 0;
+    while (out.size() < size) {
+        ms += rng.below(50);
+        out += "2026-01-01 " + QByteArray::number(ms / 3600000 % 24).rightJustified(2, '0') + ':'
+             + QByteArray::number(ms / 60000 % 60).rightJustified(2, '0') + ':'
+             + QByteArray::number(ms / 1000 % 60).rightJustified(2, '0') + '.'
+             + QByteArray::number(ms % 1000).rightJustified(3, '0') + ' ' + levels[rng.below(3)]
+             + " worker[" + QByteArray::number(rng.below(16)) + "] request id="
+             + QByteArray::number(rng.next()) + " took " + QByteArray::number(rng.below(900)) + "ms\r\n";
+    }
+    return out;
+}
+
+struct Stream {
+    QString name;
+    QByteArray data;
+};
+
+struct Timing {
+    qint64 bestNs = 0;
+    qint64 medianNs = 0;
+};
+
+static Timing run(const CoreInfo &core, const QByteArray &data, int iterations) {
+    QVector<qint64> ns;
+    for (int i = 0; i < iterations; ++i) {
+        Core *c = core.make(TERM_ROWS, TERM_COLS);
+        QElapsedTimer timer;
+        timer.start();
+        for (int pos = 0; pos < data.size(); pos += READ_CHUNK)
+            c->write(data.constData() + pos, size_t(qMin(READ_CHUNK, data.size() - pos)));
+        ns.append(timer.nsecsElapsed());
+        delete c;
+    }
+    std::sort(ns.begin(), ns.end());
+    Timing t;
+    t.bestNs = qMax<qint64>(ns.first(), 1);
+    t.medianNs = qMax<qint64>(ns[ns.size() / 2], 1);
+    return t;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("qTermBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Feeds byte streams through the terminal emulation cores and reports "
+                                     "throughput as JSON.");
+    parser.addHelpOption();
+    QCommandLineOption sizeOption("size", "Size of each synthetic stream in MiB (default 8).", "MiB", "8");
+    QCommandLineOption iterationsOption("iterations", "Timed runs per core and stream (default 5).", "n", "5");
+    QCommandLineOption coreOption("core", "Only run this core (grid, libvterm, tmt); repeatable.", "name");
+    QCommandLineOption streamOption("stream", "Only run this stream (ascii, sgr, tui, cjk, scroll, or a "
+                                    "recorded file name); repeatable.", "name");
+    QCommandLineOption outputOption("output", "Write the JSON report here instead of stdout.", "file");
+    parser.addOptions({ sizeOption, iterationsOption, coreOption, streamOption, outputOption });
+    parser.addPositionalArgument("recorded", "Files of recorded PTY output to run as extra streams.", "[file...]");
+    parser.process(app);
+
+    int size = qBound(1, parser.value(sizeOption).toInt(), 1024) * 1024 * 1024;
+    int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    QStringList onlyCores = parser.values(coreOption);
+    QStringList onlyStreams = parser.values(streamOption);
+
+    QVector<Stream> streams;
+    streams.append({ "ascii", asciiStream(size) });
+    streams.append({ "sgr", sgrStream(size) });
+    streams.append({ "tui", tuiStream(size) });
+    streams.append({ "cjk", cjkStream(size) });
+    streams.append({ "scroll", scrollStream(size) });
+    for (const QString &path : parser.positionalArguments()) {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "qTermBench: cannot read %s\n", qPrintable(path));
+            return 1;
+        }
+        streams.append({ QFileInfo(path).fileName(), f.readAll() });
+    }
+
+    QJsonArray results;
+    for (const CoreInfo &core : cores) {
+        if (!onlyCores.isEmpty() && !onlyCores.contains(core.name))
+            continue;
+        for (const Stream &s : streams) {
+            if (s.data.isEmpty() || (!onlyStreams.isEmpty() && !onlyStreams.contains(s.name)))
+                continue;
+            fprintf(stderr, "%-8s %-12s ", core.name, qPrintable(s.name));
+            Timing t = run(core, s.data, iterations);
+            double bytes = s.data.size();
+            QJsonObject r;
+            r["core"] = core.name;
+            r["stream"] = s.name;
+            r["bytes"] = s.data.size();
+            r["iterations"] = iterations;
+            r["best_ns"] = double(t.bestNs);
+            r["median_ns"] = double(t.medianNs);
+            r["mb_per_s"] = bytes * 1e3 / t.bestNs;         // 10^6 bytes per second
+            r["ns_per_byte"] = t.bestNs / bytes;
+            r["median_ns_per_byte"] = t.medianNs / bytes;
+            results.append(r);
+            fprintf(stderr, "%9.1f MB/s %7.2f ns/byte\n", bytes * 1e3 / t.bestNs, t.bestNs / bytes);
+        }
+    }
+
+    QJsonObject report;
+    report["benchmark"] = "throughput";
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["qt_version"] = qVersion();
+#if defined(__VERSION__)
+    report["compiler"] = __VERSION__;
+#endif
+#if defined(QT_NO_DEBUG)
+    report["build"] = "release";
+#else
+    report["build"] = "debug";
+#endif
+    report["rows"] = TERM_ROWS;
+    report["columns"] = TERM_COLS;
+    report["results"] = results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile out(parser.value(outputOption));
+        if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate) || out.write(json) != json.size()) {
+            fprintf(stderr, "qTermBench: cannot write %s\n", qPrintable(out.fileName()));
+            return 1;
+        }
+    } else {
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    }
+    return 0;
+}
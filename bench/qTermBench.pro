@@ -0,0 +1,33 @@
+QT       += core gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any Qt feature that has been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Same cell layout as the TMT widget.
+DEFINES += TMT_PACKED_CELLS
+
+SOURCES += \
+    main.cpp \
+    ../TMT-Version/tmt.c
+
+HEADERS += \
+    ../TMT-Version/tmt.h \
+    ../common/cellgrid.h \
+    ../common/gridemulator.h \
+    ../common/scrollback.h \
+    ../common/utf8.h
+
+# qmake CONFIG+=no_libvterm builds without the libvterm core.
+no_libvterm {
+    DEFINES += QTERM_BENCH_NO_LIBVTERM
+} else {
+    LIBS += -L/Users/macbook2015/Desktop/brew/lib -lvterm
+}
+
+INCLUDEPATH += $$PWD/../common $$PWD/../TMT-Version /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib /Users/macbook2015/Desktop/brew/Cellar/libvterm/0.3.3/include
@@ -0,0 +1,23 @@
+# Differential test of tmt.c's table-driven parser against the reference
+# ON/DO parser (TMT_REFERENCE_PARSER); see tmtdiff.cpp. No Qt needed.
+TEMPLATE = app
+TARGET = tmtDiff
+
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+
+# Same cell layout as the TMT widget.
+DEFINES += TMT_PACKED_CELLS
+
+SOURCES += \
+    tmtdiff.cpp \
+    tmt_reference.c \
+    ../TMT-Version/tmt.c
+
+HEADERS += \
+    ../TMT-Version/tmt.h \
+    ../common/utf8.h
+
+LIBS += -lpthread
+
+INCLUDEPATH += $$PWD/../common $$PWD/../TMT-Version
@@ -0,0 +1,18 @@
+/* tmt.c with the original ON/DO parser (TMT_REFERENCE_PARSER), its public
+ * functions renamed ref_tmt_* so it links next to the table-driven build.
+ * Only tmtDiff uses it.
+ */
+#define TMT_REFERENCE_PARSER
+
+#define tmt_open               ref_tmt_open
+#define tmt_set_unicode_decode ref_tmt_set_unicode_decode
+#define tmt_set_scroll_notify  ref_tmt_set_scroll_notify
+#define tmt_close              ref_tmt_close
+#define tmt_resize             ref_tmt_resize
+#define tmt_write              ref_tmt_write
+#define tmt_screen             ref_tmt_screen
+#define tmt_cursor             ref_tmt_cursor
+#define tmt_clean              ref_tmt_clean
+#define tmt_reset              ref_tmt_reset
+
+#include "tmt.c"
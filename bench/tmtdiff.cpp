@@ -0,0 +1,301 @@
+// tmtDiff — differential test of tmt.c's table-driven escape parser
+// against the original ON/DO chain it was built from.
+//
+// tmt_reference.c compiles tmt.c a second time with TMT_REFERENCE_PARSER
+// and its entry points renamed ref_tmt_*, so both parsers run in this one
+// binary. Every seed generates an escape-heavy stream (text, UTF-8, C0
+// controls, ESC, CSI with random parameters, OSC titles, charset
+// switches, device queries and raw noise) and writes it to both terminals
+// in the same random-sized chunks, with the occasional tmt_clean() and
+// tmt_resize() in between. After every step the screens (characters,
+// attributes, dirty flags), the cursors and the callbacks received so far
+// must be identical.
+//
+//   tmtDiff [--seeds n] [--first seed]
+//
+// Prints the first difference with its seed and exits with 1, or prints
+// the number of seeds checked and exits with 0.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+extern "C" {
+#include "tmt.h"
+
+TMT *ref_tmt_open(size_t nline, size_t ncol, TMTCALLBACK cb, void *p, const wchar_t *acs);
+bool ref_tmt_set_unicode_decode(TMT *vt, bool v);
+bool ref_tmt_set_scroll_notify(TMT *vt, bool v);
+void ref_tmt_close(TMT *vt);
+bool ref_tmt_resize(TMT *vt, size_t nline, size_t ncol);
+void ref_tmt_write(TMT *vt, const char *s, size_t n);
+const TMTSCREEN *ref_tmt_screen(const TMT *vt);
+const TMTPOINT *ref_tmt_cursor(const TMT *vt);
+void ref_tmt_clean(TMT *vt);
+}
+
+// Same generator as qTermBench, seeded per run.
+class Lcg {
+public:
+    explicit Lcg(unsigned seed) : state(0x853c49e6748fea9bull ^ (seed * 0x9e3779b97f4a7c15ull)) {}
+    unsigned next() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return unsigned(state >> 33);
+    }
+    int below(int n) { return int(next() % unsigned(n)); }
+
+private:
+    unsigned long long state;
+};
+
+static void appendNumber(std::string &out, int n) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", n);
+    out += buf;
+}
+
+// One piece of input; biased towards sequences tmt knows, with enough
+// malformed and unknown ones to exercise the error paths.
+static void appendPiece(std::string &out, Lcg &rng) {
+    static const char finals[] = "@ABCDEFGHIJKLMPSTXZbcdfghilmnrsu`qxy";
+    static const char escapes[] = "=>H78+*cMDE(0B)1A[]Z\\";
+    static const char *const utf8[] = { "\xc3\xa9", "\xe2\x94\x80", "\xe4\xb8\xad", "\xf0\x9f\x98\x80",
+                                        "\xe2\x96", "\xc3", "\xff" };
+    switch (rng.below(10)) {
+    case 0:
+    case 1: {
+        int n = 1 + rng.below(12);
+        for (int i = 0; i < n; ++i)
+            out += char(' ' + rng.below(95));
+        break;
+    }
+    case 2:
+        out += utf8[rng.below(sizeof(utf8) / sizeof(*utf8))];
+        break;
+    case 3:
+        out += char(rng.below(32));     // C0, including NUL and ESC
+        break;
+    case 4:
+        out += '\x1b';
+        out += escapes[rng.below(sizeof(escapes) - 1)];
+        break;
+    case 5:
+    case 6: {
+        out += "\x1b[";
+        if (!rng.below(4))
+            out += "?>"[rng.below(2)];
+        int pars = rng.below(4);
+        for (int i = 0; i < pars; ++i) {
+            if (i)
+                out += ';';
+            if (rng.below(5))
+                appendNumber(out, rng.below(4) ? rng.below(10) : rng.below(300));
+        }
+        out += finals[rng.below(sizeof(finals) - 1)];
+        break;
+    }
+    case 7:
+        out += "\x1b[";
+        out += rng.below(2) ? "38;5;" : "48;5;";
+        appendNumber(out, rng.below(256));
+        out += 'm';
+        break;
+    case 8: {
+        out += "\x1b]";
+        appendNumber(out, rng.below(3));
+        out += ';';
+        int n = rng.below(20);
+        for (int i = 0; i < n; ++i)
+            out += char(' ' + rng.below(95));
+        out += rng.below(4) ? "\a" : "\x1b\\";
+        break;
+    }
+    default: {
+        int n = 1 + rng.below(4);
+        for (int i = 0; i < n; ++i)
+            out += char(rng.next());
+        break;
+    }
+    }
+}
+
+// Everything a terminal reported through its callback, serialized.
+struct Log {
+    std::string text;
+    size_t cols = 0;        // width of TMT_MSG_SCROLLBACK lines
+
+    void put(const void *p, size_t n) { text.append(static_cast<const char *>(p), n); }
+    void putInt(long long v) { put(&v, sizeof(v)); }
+    void putCell(const TMTCHAR &ch) {
+        putInt(ch.c);
+        const TMTATTRS &a = ch.a;
+        putInt(a.bold | a.dim << 1 | a.underline << 2 | a.blink << 3 | a.reverse << 4 | a.invisible << 5);
+        putInt(a.fg);
+        putInt(a.bg);
+    }
+};
+
+static void callback(tmt_msg_t m, TMT *vt, const void *a, void *p) {
+    (void)vt;
+    Log *log = static_cast<Log *>(p);
+    log->putInt(m);
+    switch (m) {
+    case TMT_MSG_MOVED: {
+        const TMTPOINT *c = static_cast<const TMTPOINT *>(a);
+        log->putInt(c->r);
+        log->putInt(c->c);
+        break;
+    }
+    case TMT_MSG_ANSWER:
+    case TMT_MSG_TITLE:
+    case TMT_MSG_CURSOR:
+        log->text += static_cast<const char *>(a);
+        log->text += '\0';
+        break;
+    case TMT_MSG_SETMODE:
+    case TMT_MSG_UNSETMODE:
+        log->putInt(*static_cast<const size_t *>(a));
+        break;
+    case TMT_MSG_SCROLL: {
+        const TMTSCROLL *s = static_cast<const TMTSCROLL *>(a);
+        log->putInt(s->top);
+        log->putInt(s->bottom);
+        log->putInt(s->n);
+        break;
+    }
+    case TMT_MSG_SCROLLBACK: {
+        const TMTLINE *l = static_cast<const TMTLINE *>(a);
+        for (size_t x = 0; x < log->cols; ++x)
+            log->putCell(l->chars[x]);
+        break;
+    }
+    case TMT_MSG_UPDATE:
+    case TMT_MSG_BELL:
+        break;
+    }
+}
+
+// Screen, dirty flags and cursor as one string, so a mismatch is one
+// comparison and the first differing cell is easy to find.
+static std::string snapshot(const TMTSCREEN *s, const TMTPOINT *c) {
+    Log out;
+    out.putInt(s->nline);
+    out.putInt(s->ncol);
+    out.putInt(c->r);
+    out.putInt(c->c);
+    for (size_t y = 0; y < s->nline; ++y) {
+        out.putInt(s->lines[y]->dirty);
+        for (size_t x = 0; x < s->ncol; ++x)
+            out.putCell(s->lines[y]->chars[x]);
+    }
+    return out.text;
+}
+
+static void describe(const TMTSCREEN *s, const TMTPOINT *c, const TMTSCREEN *r, const TMTPOINT *rc) {
+    if (s->nline != r->nline || s->ncol != r->ncol) {
+        fprintf(stderr, "  size %zux%zu, reference %zux%zu\n", s->nline, s->ncol, r->nline, r->ncol);
+        return;
+    }
+    if (c->r != rc->r || c->c != rc->c)
+        fprintf(stderr, "  cursor %zu,%zu, reference %zu,%zu\n", c->r, c->c, rc->r, rc->c);
+    for (size_t y = 0; y < s->nline; ++y) {
+        if (s->lines[y]->dirty != r->lines[y]->dirty)
+            fprintf(stderr, "  line %zu dirty %d, reference %d\n", y, s->lines[y]->dirty, r->lines[y]->dirty);
+        for (size_t x = 0; x < s->ncol; ++x) {
+            Log a, b;
+            a.putCell(s->lines[y]->chars[x]);
+            b.putCell(r->lines[y]->chars[x]);
+            if (a.text != b.text) {
+                fprintf(stderr, "  first differing cell %zu,%zu: U+%04X, reference U+%04X\n", y, x,
+                        unsigned(s->lines[y]->chars[x].c), unsigned(r->lines[y]->chars[x].c));
+                return;
+            }
+        }
+    }
+}
+
+// Runs one seed; returns false and reports on the first difference.
+static bool runSeed(unsigned seed) {
+    Lcg rng(seed);
+    size_t rows = 2 + rng.below(30), cols = 2 + rng.below(100);
+    Log log, refLog;
+    log.cols = refLog.cols = cols;
+    TMT *vt = tmt_open(rows, cols, callback, &log, nullptr);
+    TMT *ref = ref_tmt_open(rows, cols, callback, &refLog, nullptr);
+    if (!vt || !ref) {
+        fprintf(stderr, "seed %u: tmt_open failed\n", seed);
+        return false;
+    }
+    bool notify = rng.below(2), decode = rng.below(2);
+    tmt_set_scroll_notify(vt, notify);
+    ref_tmt_set_scroll_notify(ref, notify);
+    tmt_set_unicode_decode(vt, decode);
+    ref_tmt_set_unicode_decode(ref, decode);
+
+    std::string input;
+    while (input.size() < 4096)
+        appendPiece(input, rng);
+
+    bool ok = true;
+    size_t pos = 0;
+    for (int step = 0; pos < input.size(); ++step) {
+        size_t len = std::min(input.size() - pos, size_t(1 + rng.below(64)));
+        tmt_write(vt, input.data() + pos, len);
+        ref_tmt_write(ref, input.data() + pos, len);
+        pos += len;
+
+        if (!rng.below(8)) {
+            tmt_clean(vt);
+            ref_tmt_clean(ref);
+        }
+        if (!rng.below(40)) {
+            rows = 2 + rng.below(30);
+            cols = 2 + rng.below(100);
+            tmt_resize(vt, rows, cols);
+            ref_tmt_resize(ref, rows, cols);
+            log.cols = refLog.cols = cols;
+        }
+
+        const TMTSCREEN *s = tmt_screen(vt), *r = ref_tmt_screen(ref);
+        const TMTPOINT *c = tmt_cursor(vt), *rc = ref_tmt_cursor(ref);
+        if (log.text != refLog.text) {
+            fprintf(stderr, "seed %u, step %d (byte %zu): callbacks differ\n", seed, step, pos);
+            ok = false;
+            break;
+        }
+        if (snapshot(s, c) != snapshot(r, rc)) {
+            fprintf(stderr, "seed %u, step %d (byte %zu): screens differ\n", seed, step, pos);
+            describe(s, c, r, rc);
+            ok = false;
+            break;
+        }
+        log.text.clear();
+        refLog.text.clear();
+    }
+
+    tmt_close(vt);
+    ref_tmt_close(ref);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned seeds = 3000, first = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--seeds") && i + 1 < argc) {
+            seeds = unsigned(strtoul(argv[++i], nullptr, 10));
+        } else if (!strcmp(argv[i], "--first") && i + 1 < argc) {
+            first = unsigned(strtoul(argv[++i], nullptr, 10));
+        } else {
+            fprintf(stderr, "usage: %s [--seeds n] [--first seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    for (unsigned seed = first; seed < first + seeds; ++seed)
+        if (!runSeed(seed))
+            return 1;
+    printf("%u seeds matched\n", seeds);
+    return 0;
+}
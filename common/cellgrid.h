@@ -0,0 +1,149 @@
+// cellgrid.h — packed terminal cells in one flat allocation.
+//
+// A PackedCell is 12 bytes: a 21-bit code point, an attribute bitfield and
+// two colours that are either "default", a 256-colour palette index or a
+// 24-bit RGB value. Colours are resolved to QRgb only when painting, so
+// cells compare with plain integer compares and runs of equal attributes
+// are cheap to find.
+//
+// CellGrid stores rows back to back in a single QVector with a fixed row
+// stride. A row is reached with one pointer offset instead of a per-row
+// heap block, the paint loop walks memory linearly, and copying a grid
+// (e.g. into a published frame) is an O(1) implicitly shared copy that
+// detaches once, as a whole, on the next write. The rows form a ring:
+// scrolling the whole grid moves the index of the top row and clears the
+// rows that come in, without moving any other cell.
+
+#ifndef CELLGRID_H
+#define CELLGRID_H
+
+#include <QVector>
+#include <QColor>
+#include <QtGlobal>
+#include <string.h>
+#include <algorithm>
+
+struct CellColor {
+    enum : quint32 { Default = 0, Indexed = 1u << 24, Rgb = 2u << 24, KindMask = 0xffu << 24 };
+
+    static quint32 indexed(int idx) { return Indexed | quint32(idx & 0xff); }
+    static quint32 rgb(int r, int g, int b) {
+        return Rgb | quint32(qBound(0, r, 255)) << 16 | quint32(qBound(0, g, 255)) << 8 | quint32(qBound(0, b, 255));
+    }
+
+    static QRgb resolve(quint32 c, QRgb def) {
+        switch (c & KindMask) {
+        case Indexed: return palette(c & 0xff);
+        case Rgb:     return 0xff000000u | (c & 0xffffff);
+        default:      return def;
+        }
+    }
+
+    // xterm's 256-colour palette.
+    static QRgb palette(int idx) {
+        static const QRgb colors[16] = {
+            0xff000000, 0xffff0000, 0xff00ff00, 0xffffff00,
+            0xff0000ff, 0xffff00ff, 0xff00ffff, 0xffffffff,
+            0xff808080, 0xffff0000, 0xff00ff00, 0xffffff00,
+            0xff0000ff, 0xffff00ff, 0xff00ffff, 0xffffffff
+        };
+        idx = qBound(0, idx, 255);
+        if (idx < 16)
+            return colors[idx];
+        if (idx < 232) {
+            static const int level[6] = { 0, 95, 135, 175, 215, 255 };
+            idx -= 16;
+            return qRgb(level[idx / 36], level[idx / 6 % 6], level[idx % 6]);
+        }
+        int grey = 8 + 10 * (idx - 232);
+        return qRgb(grey, grey, grey);
+    }
+};
+
+struct PackedCell {
+    // The low bits match GlyphAtlas::Style, so attrs & StyleMask is the
+    // glyph style.
+    enum Attr { Bold = 1, Italic = 2, Underline = 4, Inverse = 8, StyleMask = 7 };
+
+    quint32 ch : 21;
+    quint32 attrs : 11;
+    quint32 fg;             // CellColor
+    quint32 bg;             // CellColor
+
+    static PackedCell blank() { return make(' ', 0, CellColor::Default, CellColor::Default); }
+    static PackedCell make(uint ch, int attrs, quint32 fg, quint32 bg) {
+        PackedCell c;
+        c.ch = ch;
+        c.attrs = quint32(attrs);
+        c.fg = fg;
+        c.bg = bg;
+        return c;
+    }
+
+    bool isBlank() const { return ch == 0 || ch == ' '; }
+    // Same colours and attributes, i.e. paintable as one run.
+    bool sameRun(const PackedCell &o) const { return attrs == o.attrs && fg == o.fg && bg == o.bg; }
+};
+
+Q_DECLARE_TYPEINFO(PackedCell, Q_PRIMITIVE_TYPE);
+static_assert(sizeof(PackedCell) == 12, "PackedCell is expected to be 12 bytes");
+
+class CellGrid {
+public:
+    CellGrid() {}
+    CellGrid(int rows, int cols) { resize(rows, cols); }
+
+    int rows() const { return nrows; }
+    int columns() const { return ncols; }
+
+    // Row pointers are valid until the next resize(). The non-const
+    // overload detaches a shared grid first.
+    PackedCell *row(int y) { return cells.data() + slot(y) * ncols; }
+    const PackedCell *row(int y) const { return cells.constData() + slot(y) * ncols; }
+    PackedCell &at(int y, int x) { return row(y)[x]; }
+    const PackedCell &at(int y, int x) const { return row(y)[x]; }
+
+    // Keeps the top-left content that still fits; new cells are blank.
+    void resize(int rows, int cols) {
+        rows = qMax(rows, 0);
+        cols = qMax(cols, 0);
+        if (rows == nrows && cols == ncols)
+            return;
+        QVector<PackedCell> next(rows * cols, PackedCell::blank());
+        int keepRows = qMin(rows, nrows), keepCols = qMin(cols, ncols);
+        for (int y = 0; y < keepRows; ++y)
+            memcpy(next.data() + y * cols, row(y), keepCols * sizeof(PackedCell));
+        cells.swap(next);
+        nrows = rows;
+        ncols = cols;
+        top = 0;
+    }
+
+    // Rows move up by n, or down by -n; the vacated rows are blank.
+    void scroll(int n) {
+        if (qAbs(n) >= nrows) {
+            cells.fill(PackedCell::blank());
+            return;
+        }
+        top = (top + n + nrows) % nrows;
+        for (int y = n > 0 ? nrows - n : 0; y < (n > 0 ? nrows : -n); ++y)
+            std::fill_n(row(y), ncols, PackedCell::blank());
+    }
+
+    void copyRow(int to, int from) {
+        if (to != from)
+            memcpy(row(to), row(from), ncols * sizeof(PackedCell));
+    }
+
+private:
+    int slot(int y) const {
+        y += top;
+        return y < nrows ? y : y - nrows;
+    }
+
+    QVector<PackedCell> cells;
+    int nrows = 0, ncols = 0;
+    int top = 0;                // slot of row 0
+};
+
+#endif // CELLGRID_H
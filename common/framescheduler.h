@@ -0,0 +1,144 @@
+// framescheduler.h — coalesces repaint requests into paced frames.
+//
+// Output handlers call requestFrame() as often as they like; damage is
+// accumulated and handed to QWidget::update() at most once per frame
+// interval. The interval comes from the max-FPS setting, or from the
+// screen's refresh rate when that is 0 (Qt's raster backend has no vsync
+// signal to lock on to). update() only queues a paint event, so parsing
+// never waits for painting.
+//
+// In low-latency mode (the default) the first request after an idle period
+// is flushed immediately, so a keystroke echo is not delayed by a frame;
+// otherwise it waits one interval to batch the start of a burst.
+//
+// requestScroll() records that content already on screen has moved. At
+// flush time it becomes one QWidget::scroll() blit of the backing store, so
+// a scrolling burst costs a blit plus the newly exposed rows instead of a
+// full repaint.
+
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QWidget>
+#include <QWindow>
+#include <QScreen>
+#include <QGuiApplication>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QRegion>
+
+#include "perfcounters.h"
+
+class FrameScheduler {
+public:
+    explicit FrameScheduler(QWidget *target) : widget(target) {
+        timer.setSingleShot(true);
+        timer.setTimerType(Qt::PreciseTimer);
+        QObject::connect(&timer, &QTimer::timeout, [this]() { flush(); });
+        clock.start();
+    }
+
+    // 0 follows the display refresh rate.
+    void setMaxFramesPerSecond(int fps) { maxFps = qMax(fps, 0); }
+    int maxFramesPerSecond() const { return maxFps; }
+
+    void setLowLatencyFirstFrame(bool on) { lowLatency = on; }
+    bool lowLatencyFirstFrame() const { return lowLatency; }
+
+    void requestFrame() {
+        whole = true;
+        schedule();
+    }
+
+    void requestFrame(const QRegion &damage) {
+        if (!whole)
+            pending += damage;
+        schedule();
+    }
+
+    // The pixels inside area moved by (dx, dy) since they were last painted,
+    // as with QWidget::scroll(). Pending damage inside area moves along.
+    // Scrolls of the same area accumulate into one blit; a scroll of a
+    // different area flushes the previous one first.
+    void requestScroll(const QRect &area, int dx, int dy) {
+        if (!whole && !area.isEmpty()) {
+            if (scrollDelta != QPoint() && area != scrollArea) {
+                widget->scroll(scrollDelta.x(), scrollDelta.y(), scrollArea);
+                scrollDelta = QPoint();
+            }
+            QRegion moved = (pending & area).translated(dx, dy) & area;
+            pending = (pending - area) + moved;
+            scrollArea = area;
+            scrollDelta += QPoint(dx, dy);
+            if (qAbs(scrollDelta.x()) >= area.width() || qAbs(scrollDelta.y()) >= area.height()) {
+                // Everything scrolled out; a repaint is cheaper than a blit.
+                pending += area;
+                scrollDelta = QPoint();
+            }
+        }
+        schedule();
+    }
+
+    // Frames folded into an already scheduled one, for instrumentation.
+    quint64 coalescedRequests() const { return coalesced; }
+    // Also counted as PerfCounters::FramesCoalesced; none if null.
+    void setCounters(PerfCounters *c) { counters = c; }
+
+private:
+    qint64 intervalNs() const {
+        qreal hz = maxFps;
+        if (hz <= 0) {
+            QWindow *w = widget->window()->windowHandle();
+            QScreen *s = w ? w->screen() : QGuiApplication::primaryScreen();
+            hz = s ? s->refreshRate() : 60;
+            if (hz <= 0)
+                hz = 60;
+        }
+        return qint64(1e9 / hz);
+    }
+
+    void schedule() {
+        if (timer.isActive()) {
+            ++coalesced;
+            if (counters)
+                counters->add(PerfCounters::FramesCoalesced);
+            return;
+        }
+        qint64 interval = intervalNs();
+        qint64 since = clock.nsecsElapsed() - lastFrame;
+        if (since >= interval && lowLatency) {
+            flush();
+            return;
+        }
+        qint64 wait = since >= interval ? interval : interval - since;
+        timer.start(int((wait + 999999) / 1000000));
+    }
+
+    void flush() {
+        lastFrame = clock.nsecsElapsed();
+        if (!whole && scrollDelta != QPoint())
+            widget->scroll(scrollDelta.x(), scrollDelta.y(), scrollArea);
+        scrollDelta = QPoint();
+        if (whole)
+            widget->update();
+        else if (!pending.isEmpty())
+            widget->update(pending);
+        whole = false;
+        pending = QRegion();
+    }
+
+    QWidget *widget;
+    QTimer timer;
+    QElapsedTimer clock;
+    qint64 lastFrame = -1000000000;
+    QRegion pending;
+    QRect scrollArea;
+    QPoint scrollDelta;
+    bool whole = false;
+    int maxFps = 0;
+    bool lowLatency = true;
+    quint64 coalesced = 0;
+    PerfCounters *counters = nullptr;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,102 @@
+// glyphatlas.h — cache of rasterized glyphs for cell-based text painting.
+//
+// Each (codepoint, style, foreground colour) is drawn with QPainter::drawText
+// once, into a cell-sized slot of a transparent pixmap page. Every later use
+// is a drawPixmap() sub-rect blit, so a repaint no longer shapes and lays
+// out text per cell. Pages are allocated on demand; when the cache is full
+// it is dropped wholesale and refilled by the next frames.
+//
+// Glyphs are clipped to their cell. Must be used from the GUI thread.
+
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <QPainter>
+#include <QPixmap>
+#include <QFont>
+#include <QHash>
+#include <QVector>
+#include <QString>
+#include <QtMath>
+
+class GlyphAtlas {
+public:
+    enum Style { Bold = 1, Italic = 2, Underline = 4 };
+
+    // Cell geometry as the widget lays it out: text sits on the baseline at
+    // cellHeight - baseline from the top of the cell, as with drawText().
+    void setFont(const QFont &f, int cellWidth, int cellHeight, int baselineOffset) {
+        font = f;
+        cw = cellWidth;
+        ch = cellHeight;
+        baseline = baselineOffset;
+        clear();
+    }
+
+    void setDevicePixelRatio(qreal ratio) {
+        if (ratio != dpr) {
+            dpr = ratio;
+            clear();
+        }
+    }
+
+    void clear() {
+        pages.clear();
+        slots.clear();
+    }
+
+    int glyphCount() const { return slots.size(); }
+
+    // Paint the glyph for ucs4 into the cell whose top-left corner is (x, y).
+    void draw(QPainter &p, int x, int y, uint ucs4, int style, QRgb fg) {
+        quint64 key = quint64(ucs4 & 0x1fffff) | quint64(style & 7) << 21 | quint64(fg & 0xffffff) << 24;
+        auto it = slots.constFind(key);
+        int slot = it != slots.constEnd() ? *it : insert(key, ucs4, style, fg);
+        QPoint at = slotOrigin(slot);
+        p.drawPixmap(QRectF(x, y, cw, ch), pages.at(slot / SlotsPerPage),
+                     QRectF(at.x() * dpr, at.y() * dpr, cw * dpr, ch * dpr));
+    }
+
+private:
+    enum { PageColumns = 32, PageRows = 16, SlotsPerPage = PageColumns * PageRows, MaxPages = 16 };
+
+    QPoint slotOrigin(int slot) const {
+        int i = slot % SlotsPerPage;
+        return QPoint(i % PageColumns * cw, i / PageColumns * ch);
+    }
+
+    int insert(quint64 key, uint ucs4, int style, QRgb fg) {
+        if (slots.size() >= SlotsPerPage * MaxPages)
+            clear();
+        int slot = slots.size();
+        if (slot % SlotsPerPage == 0) {
+            QPixmap page(qCeil(PageColumns * cw * dpr), qCeil(PageRows * ch * dpr));
+            page.setDevicePixelRatio(dpr);
+            page.fill(Qt::transparent);
+            pages.append(page);
+        }
+
+        QFont f = font;
+        f.setBold(style & Bold);
+        f.setItalic(style & Italic);
+        f.setUnderline(style & Underline);
+
+        QPoint at = slotOrigin(slot);
+        QPainter gp(&pages.last());
+        gp.setClipRect(at.x(), at.y(), cw, ch);
+        gp.setFont(f);
+        gp.setPen(QColor::fromRgb(fg));
+        gp.drawText(at.x(), at.y() + ch - baseline, QString::fromUcs4(&ucs4, 1));
+
+        slots.insert(key, slot);
+        return slot;
+    }
+
+    QFont font;
+    int cw = 1, ch = 1, baseline = 0;
+    qreal dpr = 1;
+    QVector<QPixmap> pages;
+    QHash<quint64, int> slots;
+};
+
+#endif // GLYPHATLAS_H
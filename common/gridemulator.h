@@ -0,0 +1,258 @@
+// gridemulator.h — the hand-rolled VT parser writing into a CellGrid.
+//
+// Escape sequences are parsed as a stream, after the DEC/VT500 state
+// diagram, so a sequence split across writes just resumes. Parameters go
+// into a fixed array and OSC strings into a fixed buffer (excess is
+// dropped), so nothing is allocated per sequence. Text is decoded as
+// UTF-8 with utf8_step(); CSI sequences other than SGR are consumed and
+// ignored.
+//
+// It knows nothing about widgets or PTYs: the root TerminalWidget feeds it
+// PTY output and paints screen(), and the benchmark feeds it byte streams.
+
+#ifndef GRIDEMULATOR_H
+#define GRIDEMULATOR_H
+
+#include <QString>
+#include <QtGlobal>
+#include <functional>
+
+#include "cellgrid.h"
+#include "scrollback.h"
+#include "utf8.h"
+
+class GridEmulator {
+public:
+    GridEmulator(int rows, int cols) { resize(rows, cols); }
+
+    // Lines scrolled off the top are pushed here; none if null.
+    void setScrollback(Scrollback *sb) { scrollback = sb; }
+    // OSC 0 and 2.
+    void setTitleCallback(std::function<void(const QString &)> cb) { titleChanged = std::move(cb); }
+
+    // Keeps the top-left content that fits; the cursor is clamped on the
+    // next line feed.
+    void resize(int newRows, int newCols) {
+        rows = qMax(newRows, 0);
+        cols = qMax(newCols, 0);
+        screen.resize(rows, cols);
+    }
+
+    const CellGrid &cells() const { return screen; }
+    CellGrid &cells() { return screen; }
+    int cursorColumn() const { return cursorX; }
+    int cursorRow() const { return cursorY; }
+    // Lines scrolled off the top so far.
+    quint64 scrolledLines() const { return scrolled; }
+
+    void write(const char *data, int len) {
+        for (int i = 0; i < len; ++i) {
+            uchar byte = data[i];
+            if (parseState != Ground) {
+                parseByte(byte);
+                continue;
+            }
+            if (byte < 0x80 && !utf8_idle(&utf8)) {
+                // An ASCII byte cuts a multibyte character short.
+                utf8_init(&utf8);
+                putChar(UTF8_REPLACEMENT);
+            }
+            if (byte == '\x1B') {
+                parseState = Escape;
+            } else if (byte == '\n') {
+                cursorX = 0;
+                lineFeed();
+            } else {
+                int again;
+                do {
+                    uint32_t cp = utf8_step(&utf8, byte, &again);
+                    if (cp != UTF8_NEED_MORE)
+                        putChar(cp);
+                } while (again);
+            }
+        }
+    }
+
+private:
+    enum ParseState { Ground, Escape, Csi, Osc, Dcs };
+    enum { MaxParams = 32, MaxOsc = 512 };
+
+    CellGrid screen;
+    int rows = 0, cols = 0;
+    int cursorX = 0, cursorY = 0;
+    quint32 currentFg = CellColor::Default;
+    quint32 currentBg = CellColor::Default;
+    int currentAttrs = 0;           // PackedCell::Attr
+    ParseState parseState = Ground;
+    int params[MaxParams];
+    int paramCount = 0;
+    quint32 colonParams = 0;    // bit i: params[i] is a ':' sub-parameter
+    char csiPrivate = 0;
+    char oscBuf[MaxOsc];
+    int oscLen = 0;
+    utf8_decoder utf8 = {};
+    quint64 scrolled = 0;
+    Scrollback *scrollback = nullptr;
+    std::function<void(const QString &)> titleChanged;
+
+    void putChar(uint32_t cp) {
+        if (cursorY < rows && cursorX < cols)
+            screen.at(cursorY, cursorX) = PackedCell::make(cp, currentAttrs, currentFg, currentBg);
+        cursorX++;
+        if (cursorX >= cols) {
+            cursorX = 0;
+            lineFeed();
+        }
+    }
+
+    // At the bottom row the screen scrolls up; the grid only rotates.
+    void lineFeed() {
+        if (cursorY + 1 < rows) {
+            ++cursorY;
+        } else {
+            cursorY = rows - 1;
+            if (scrollback)
+                scrollback->push(screen.row(0), cols);
+            screen.scroll(1);
+            ++scrolled;
+        }
+    }
+
+    // One byte of an escape sequence; ESC itself was seen in Ground.
+    void parseByte(uchar byte) {
+        if (byte == '\x1B') {
+            // Also the first half of ST (ESC \), which ends OSC and DCS.
+            if (parseState == Osc)
+                dispatchOsc();
+            parseState = Escape;
+            return;
+        }
+        if (byte == 0x18 || byte == 0x1A) {     // CAN, SUB
+            parseState = Ground;
+            return;
+        }
+
+        switch (parseState) {
+        case Escape:
+            if (byte == '[') {
+                params[0] = 0;
+                paramCount = 1;
+                colonParams = 0;
+                csiPrivate = 0;
+                parseState = Csi;
+            } else if (byte == ']') {
+                oscLen = 0;
+                parseState = Osc;
+            } else if (byte == 'P') {
+                parseState = Dcs;
+            } else if (byte >= 0x30 && byte <= 0x7E) {
+                parseState = Ground;            // other escapes are not supported
+            }
+            break;                              // intermediates wait for the final byte
+        case Csi:
+            if (byte >= '0' && byte <= '9') {
+                int &p = params[paramCount - 1];
+                p = qMin(p * 10 + (byte - '0'), 0xFFFF);
+            } else if (byte == ';' || byte == ':') {
+                if (paramCount < MaxParams) {
+                    if (byte == ':')
+                        colonParams |= 1u << paramCount;
+                    params[paramCount++] = 0;
+                }
+            } else if (byte >= '<' && byte <= '?') {
+                csiPrivate = char(byte);
+            } else if (byte >= 0x40 && byte <= 0x7E) {
+                dispatchCsi(char(byte));
+                parseState = Ground;
+            }
+            break;
+        case Osc:
+            if (byte == 0x07) {
+                dispatchOsc();
+                parseState = Ground;
+            } else if (byte >= 0x20 && oscLen < MaxOsc) {
+                oscBuf[oscLen++] = char(byte);
+            }
+            break;
+        case Dcs:                               // swallowed up to ST
+        case Ground:
+            break;
+        }
+    }
+
+    void dispatchCsi(char final) {
+        if (final == 'm' && !csiPrivate)
+            selectGraphicRendition();
+    }
+
+    void dispatchOsc() {
+        // OSC 0 and 2 set the window title.
+        if (oscLen >= 2 && (oscBuf[0] == '0' || oscBuf[0] == '2') && oscBuf[1] == ';')
+            if (titleChanged)
+                titleChanged(QString::fromUtf8(oscBuf + 2, oscLen - 2));
+    }
+
+    void selectGraphicRendition() {
+        for (int i = 0; i < paramCount; ++i) {
+            int p = params[i];
+            switch (p) {
+            case 0:
+                currentFg = currentBg = CellColor::Default;
+                currentAttrs = 0;
+                break;
+            case 1:  currentAttrs |= PackedCell::Bold; break;
+            case 3:  currentAttrs |= PackedCell::Italic; break;
+            case 4:  currentAttrs |= PackedCell::Underline; break;
+            case 7:  currentAttrs |= PackedCell::Inverse; break;
+            case 22: currentAttrs &= ~PackedCell::Bold; break;
+            case 23: currentAttrs &= ~PackedCell::Italic; break;
+            case 24: currentAttrs &= ~PackedCell::Underline; break;
+            case 27: currentAttrs &= ~PackedCell::Inverse; break;
+            case 38: i = extendedColor(i, &currentFg); break;
+            case 48: i = extendedColor(i, &currentBg); break;
+            case 39: currentFg = CellColor::Default; break;
+            case 49: currentBg = CellColor::Default; break;
+            default:
+                if (p >= 30 && p <= 37)
+                    currentFg = CellColor::indexed(p - 30);
+                else if (p >= 40 && p <= 47)
+                    currentBg = CellColor::indexed(p - 40);
+                else if (p >= 90 && p <= 97)
+                    currentFg = CellColor::indexed(p - 90 + 8);
+                else if (p >= 100 && p <= 107)
+                    currentBg = CellColor::indexed(p - 100 + 8);
+                break;
+            }
+        }
+    }
+
+    // params[i] is 38 or 48. Reads "5;n" / "2;r;g;b", or the ':' forms
+    // "5:n" / "2:r:g:b" / "2:cs:r:g:b", into *c (left alone if malformed)
+    // and returns the index of the last parameter used.
+    int extendedColor(int i, quint32 *c) const {
+        int subs = 0;
+        while (i + subs + 1 < paramCount && (colonParams >> (i + subs + 1) & 1))
+            ++subs;
+        int kind = i + 1 < paramCount ? params[i + 1] : -1;
+        if (subs) {
+            if (kind == 5 && subs >= 2)
+                *c = CellColor::indexed(params[i + 2]);
+            else if (kind == 2 && subs >= 4) {
+                int b = i + subs - 2;
+                *c = CellColor::rgb(params[b], params[b + 1], params[b + 2]);
+            }
+            return i + subs;
+        }
+        if (kind == 5 && i + 2 < paramCount) {
+            *c = CellColor::indexed(params[i + 2]);
+            return i + 2;
+        }
+        if (kind == 2 && i + 4 < paramCount) {
+            *c = CellColor::rgb(params[i + 2], params[i + 3], params[i + 4]);
+            return i + 4;
+        }
+        return paramCount - 1;
+    }
+};
+
+#endif // GRIDEMULATOR_H
@@ -0,0 +1,107 @@
+// historyview.h — a viewport over the scrollback and the live screen.
+//
+// Scrolled back by offset() lines, the viewport shows the last offset()
+// history lines above the screen, which is pushed down by as many rows.
+// Nothing outside the viewport is ever fetched: a paint asks for the
+// history lines of its visible rows only, and those go through a small
+// direct-mapped cache keyed by line number. Dragging the scroll bar back
+// and forth therefore decodes each line once, and the cost of a frame
+// depends on the viewport height, not on how long the history is.
+//
+// Lines are numbered absolutely (Scrollback::droppedLines() + index), so
+// a scrolled-back view stays on the same text while new lines arrive and
+// old ones are trimmed.
+
+#ifndef HISTORYVIEW_H
+#define HISTORYVIEW_H
+
+#include <QVector>
+#include <QtGlobal>
+#include <algorithm>
+
+#include "cellgrid.h"
+#include "scrollback.h"
+
+class HistoryView {
+public:
+    enum { CacheLines = 1024 };
+
+    HistoryView() : cache(CacheLines) {}
+
+    // History lines shown above the screen; 0 is the live screen.
+    int offset() const { return back; }
+    bool isLive() const { return back == 0; }
+    int lineCount() const { return count; }
+
+    // The history now holds lines [first, first + count). A scrolled-back
+    // view keeps the same line at the top; returns true if offset()
+    // changed because of it.
+    bool setHistory(qint64 historyFirst, int historyCount) {
+        int before = back;
+        if (historyFirst + historyCount < first + count) {
+            // Cleared; nothing cached is valid any more.
+            invalidate();
+            back = 0;
+        }
+        first = historyFirst;
+        count = historyCount;
+        if (back)
+            back = int(first + count - qMax(top, first));
+        top = first + count - back;
+        return back != before;
+    }
+
+    // Scroll bar position: 0 shows the oldest line, lineCount() is live.
+    int scrollValue() const { return count - back; }
+    void scrollTo(int value) {
+        back = count - qBound(0, value, count);
+        top = first + count - back;
+    }
+
+    // Viewport row y shows history line lineAt(y) if y < offset(), and
+    // screen row y - offset() otherwise.
+    qint64 lineAt(int y) const { return top + y; }
+
+    // History line n padded with blanks to cols cells. The pointer stays
+    // valid until a line CacheLines apart is fetched. The caller keeps
+    // pushes to sb out while this runs.
+    const PackedCell *line(const Scrollback &sb, qint64 n, int cols) {
+        Line &l = cache[int(n % CacheLines)];
+        if (l.number != n || l.cells.size() < cols) {
+            sb.line(int(n - sb.droppedLines()), &l.cells);
+            int stored = l.cells.size();
+            if (stored < cols) {
+                l.cells.resize(cols);
+                std::fill(l.cells.begin() + stored, l.cells.end(), PackedCell::blank());
+            }
+            l.number = n;
+        }
+        return l.cells.constData();
+    }
+
+    void invalidate() {
+        for (Line &l : cache)
+            l.number = -1;
+    }
+
+    // The history was replaced; back to the live screen.
+    void reset() {
+        invalidate();
+        first = top = 0;
+        count = back = 0;
+    }
+
+private:
+    struct Line {
+        qint64 number = -1;
+        QVector<PackedCell> cells;
+    };
+
+    QVector<Line> cache;
+    qint64 first = 0;
+    int count = 0;
+    int back = 0;
+    qint64 top = 0;             // line at viewport row 0 when scrolled back
+};
+
+#endif // HISTORYVIEW_H
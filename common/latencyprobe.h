@@ -0,0 +1,169 @@
+// latencyprobe.h — keystroke-to-pixel latency, split into stages.
+//
+// One probe is in flight at a time. A key press starts it and each later
+// mark closes one stage:
+//
+//   input     keyPressEvent            -> PtyWriter flushed it to the PTY
+//   pty       flushed                  -> first output read back (the echo)
+//   parse     output read              -> parsed and handed to the GUI thread
+//   schedule  parsed                   -> paintEvent starts
+//   paint     paintEvent starts        -> paintEvent returns
+//   total     keyPressEvent            -> paintEvent returns
+//
+// The first output after the write is taken to be the echo, and the first
+// paint after it to be the one that draws it; a key that echoes nothing
+// leaves the probe waiting until the next key press a second later.
+//
+// Marks may come from the reader or parser threads: a stage is only taken
+// by the thread whose turn it is, which claims it by moving an atomic stage
+// counter to Busy while it writes the timestamp, so a key press giving up
+// on a stale probe cannot be overwritten by a late mark. The timestamps
+// come from one monotonic clock. Histograms are only touched from the GUI
+// thread (paintFinished() and report()).
+//
+// Durations go into log-linear histograms with eight sub-buckets per
+// power of two, i.e. percentiles within 12.5%; the maximum is exact.
+
+#ifndef LATENCYPROBE_H
+#define LATENCYPROBE_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QtAlgorithms>
+#include <QtGlobal>
+#include <atomic>
+#include <string.h>
+
+class LatencyProbe {
+public:
+    enum Stage { Input, Pty, Parse, Schedule, Paint, Total, StageCount };
+
+    LatencyProbe() { clock.start(); }
+
+    void setEnabled(bool on) {
+        enabled = on;
+        next = Idle;
+    }
+    bool isEnabled() const { return enabled; }
+
+    // GUI thread. A probe left waiting for an echo for a second is given
+    // up, so a key that produced no output does not block the next one.
+    void keyPressed() {
+        if (!enabled)
+            return;
+        qint64 now = clock.nsecsElapsed();
+        int n = next.load(std::memory_order_acquire);
+        if (n == Busy || (n != Idle && n != WaitWrite && now - stamps[KeyPressed] < 1000000000))
+            return;
+        if (!next.compare_exchange_strong(n, Busy, std::memory_order_acquire))
+            return;
+        stamps[KeyPressed] = now;
+        next.store(WaitWrite, std::memory_order_release);
+    }
+    void written() { mark(WaitWrite); }
+    // Any thread.
+    void outputRead() { mark(WaitRead); }
+    void parsed() { mark(WaitParse); }
+    // GUI thread.
+    void paintStarted() { mark(WaitPaint); }
+    void paintFinished() {
+        if (!mark(WaitPaintEnd))
+            return;
+        for (int s = 0; s < Total; ++s)
+            histograms[s].add(stamps[s + 1] - stamps[s]);
+        histograms[Total].add(stamps[PaintEnd] - stamps[KeyPressed]);
+    }
+
+    void reset() {
+        for (Histogram &h : histograms)
+            h = Histogram();
+        next = Idle;
+    }
+
+    // A table of count, p50, p99 and max per stage, in microseconds.
+    QString report() const {
+        static const char *const names[StageCount] = { "input", "pty", "parse", "schedule", "paint", "total" };
+        QString out = QStringLiteral("latency (us)      count       p50       p99       max\n");
+        for (int s = 0; s < StageCount; ++s) {
+            const Histogram &h = histograms[s];
+            out += QStringLiteral("%1%2%3%4%5\n")
+                       .arg(QLatin1String(names[s]), -12)
+                       .arg(h.count, 11)
+                       .arg(h.percentile(0.50) / 1000, 10)
+                       .arg(h.percentile(0.99) / 1000, 10)
+                       .arg(h.max / 1000, 10);
+        }
+        return out;
+    }
+
+private:
+    // Timestamps, in order; stage s lasts from stamps[s] to stamps[s + 1].
+    enum Stamp { KeyPressed, Written, Read, Parsed, PaintStart, PaintEnd, StampCount };
+    // Values of next: the stamp expected next, Idle, or Busy while a stamp
+    // is being written.
+    enum { WaitWrite = Written, WaitRead = Read, WaitParse = Parsed, WaitPaint = PaintStart,
+           WaitPaintEnd = PaintEnd, Idle = StampCount, Busy };
+
+    struct Histogram {
+        enum { SubBits = 3, Buckets = 64 << SubBits };
+        quint64 counts[Buckets];
+        quint64 count = 0;
+        qint64 max = 0;
+
+        Histogram() { memset(counts, 0, sizeof(counts)); }
+
+        // Values below 2^SubBits get a bucket each; above, a power of two
+        // is split into 2^SubBits buckets.
+        static int bucket(quint64 v) {
+            if (v < (1u << SubBits))
+                return int(v);
+            int msb = 63 - int(qCountLeadingZeroBits(v));
+            return ((msb - SubBits + 1) << SubBits) | int((v >> (msb - SubBits)) & ((1u << SubBits) - 1));
+        }
+        static qint64 lowest(int b) {
+            if (b < (1 << SubBits))
+                return b;
+            int msb = (b >> SubBits) + SubBits - 1;
+            return qint64((quint64(1) << msb) | (quint64(b & ((1 << SubBits) - 1)) << (msb - SubBits)));
+        }
+
+        void add(qint64 ns) {
+            ns = qMax<qint64>(ns, 0);
+            ++counts[bucket(quint64(ns))];
+            ++count;
+            max = qMax(max, ns);
+        }
+
+        qint64 percentile(double p) const {
+            if (!count)
+                return 0;
+            quint64 rank = quint64(p * (count - 1)) + 1, seen = 0;
+            for (int b = 0; b < Buckets; ++b) {
+                seen += counts[b];
+                if (seen >= rank)
+                    return qMin(lowest(b + 1) - 1, max);    // the bucket's upper bound
+            }
+            return max;
+        }
+    };
+
+    // Takes the stamp if it is the one expected; returns false otherwise.
+    bool mark(int stamp) {
+        if (!enabled)
+            return false;
+        int expected = stamp;
+        if (!next.compare_exchange_strong(expected, Busy, std::memory_order_acquire))
+            return false;
+        stamps[stamp] = clock.nsecsElapsed();
+        next.store(stamp + 1, std::memory_order_release);
+        return true;
+    }
+
+    QElapsedTimer clock;
+    std::atomic<bool> enabled{false};
+    std::atomic<int> next{Idle};
+    qint64 stamps[StampCount] = {};
+    Histogram histograms[StageCount];
+};
+
+#endif // LATENCYPROBE_H
@@ -0,0 +1,142 @@
+// parserworker.h — thread that owns a terminal emulator's parser state.
+//
+// The worker drains the PtyReader's ring into the parse function and, at
+// frame boundaries (the ring ran dry, or frameInterval passed while output
+// kept streaming), calls the publish function so the owner can copy its
+// screen into a TripleBuffer, followed by the frame callback. Both run on
+// the worker thread; the frame callback typically posts to the GUI thread.
+//
+// Anything else that must touch the emulator state (resize, reset, ...) is
+// handed over with post() and runs on the worker between parse calls, at
+// the latest after the next frame boundary.
+
+#ifndef PARSERWORKER_H
+#define PARSERWORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <functional>
+
+#include "ptyreader.h"
+
+class ParserWorker : public QThread {
+public:
+    explicit ParserWorker(PtyReader *reader) : reader(reader) {}
+
+    ~ParserWorker() override { stop(); }
+
+    // Configure before start().
+    void setParseFunction(std::function<void(const char *, size_t)> fn) { parse = std::move(fn); }
+    void setPublishFunction(std::function<void()> fn) { publish = std::move(fn); }
+    void setFrameCallback(std::function<void()> fn) { onFrame = std::move(fn); }
+    void setFrameInterval(int msec) { interval = msec; }
+
+    // Safe from any thread; the reader's data callback calls this.
+    void wake() {
+        QMutexLocker lock(&mutex);
+        woken = true;
+        cond.wakeOne();
+    }
+
+    void post(std::function<void()> cmd) {
+        QMutexLocker lock(&mutex);
+        commands.append(std::move(cmd));
+        woken = true;
+        cond.wakeOne();
+    }
+
+    void stop() {
+        if (!isRunning())
+            return;
+        {
+            QMutexLocker lock(&mutex);
+            stopping = true;
+            cond.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run() override {
+        QElapsedTimer frameClock;
+        frameClock.start();
+        bool dirty = false;
+        bool more = false;      // stopped mid-stream; the ring still has data
+
+        for (;;) {
+            QVector<std::function<void()>> cmds;
+            {
+                QMutexLocker lock(&mutex);
+                while (!woken && !stopping && !more)
+                    cond.wait(&mutex);
+                cmds.swap(commands);
+                woken = false;
+                if (stopping) {
+                    lock.unlock();
+                    for (auto &cmd : cmds)
+                        cmd();
+                    break;
+                }
+            }
+            for (auto &cmd : cmds)
+                cmd();
+            dirty = dirty || !cmds.isEmpty();
+            more = false;
+
+            SpscByteRing &ring = reader->ring();
+            for (;;) {
+                size_t len;
+                const char *data = ring.readSpan(&len);
+                if (!len)
+                    break;
+                parse(data, len);
+                ring.commitRead(len);
+                dirty = true;
+                if (frameClock.elapsed() >= interval) {
+                    publishFrame();
+                    dirty = false;
+                    frameClock.restart();
+                    // Back to the top so posted commands and stop() are
+                    // not starved by output that never lets up.
+                    more = true;
+                    break;
+                }
+            }
+            if (more)
+                continue;
+            reader->acknowledge();
+
+            if (dirty) {
+                publishFrame();
+                dirty = false;
+                frameClock.restart();
+            }
+        }
+    }
+
+private:
+    void publishFrame() {
+        if (publish)
+            publish();
+        if (onFrame)
+            onFrame();
+    }
+
+    PtyReader *reader;
+    std::function<void(const char *, size_t)> parse;
+    std::function<void()> publish;
+    std::function<void()> onFrame;
+    int interval = 16;
+
+    QMutex mutex;
+    QWaitCondition cond;
+    QVector<std::function<void()>> commands;
+    bool woken = false;
+    bool stopping = false;
+};
+
+#endif // PARSERWORKER_H
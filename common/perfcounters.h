@@ -0,0 +1,268 @@
+// perfcounters.h — event counters and a per-frame trace for a terminal.
+//
+// Counters cover the whole pipeline: PTY reads, parsing (bytes, control
+// codes and escape sequences by kind, printable characters written to the
+// grid, lines scrolled), painting (frames, cells, time) and frames the
+// scheduler or the triple buffer folded together. Every hook starts with
+// one relaxed load of the enabled flag, and counters are relaxed atomic
+// adds, so they can be left compiled in; defining QTERM_NO_PERF_COUNTERS
+// turns isEnabled() into a constant false and removes them altogether.
+//
+// Escape sequences are classified by a small scanner over the bytes handed
+// to the parser, so the three emulators are counted the same way without
+// hooks inside tmt.c or libvterm. It runs on the parsing thread only, and
+// only while enabled.
+//
+// Tracing is separate and also off by default. It keeps the last
+// TraceCapacity spans (reads, parse batches, published frames, paints) in
+// a ring behind a mutex and writes them as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open.
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QtGlobal>
+#include <atomic>
+
+class PerfCounters {
+public:
+    enum Counter {
+        BytesRead, ReadCalls,
+        BytesParsed, ControlCodes, EscSequences, CsiSequences, OscSequences, DcsSequences,
+        CellsWritten, LinesScrolled,
+        FramesPainted, CellsPainted, PaintNs,
+        FramesCoalesced, FramesDropped,
+        CounterCount
+    };
+    enum { TraceCapacity = 1 << 16 };
+
+    PerfCounters() {
+        clock.start();
+        for (std::atomic<quint64> &c : counts)
+            c.store(0, std::memory_order_relaxed);
+    }
+
+#ifdef QTERM_NO_PERF_COUNTERS
+    void setEnabled(bool) {}
+    bool isEnabled() const { return false; }
+    void setTracing(bool) {}
+    bool isTracing() const { return false; }
+#else
+    void setEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+    // Implies nothing about the counters; either can be on alone.
+    void setTracing(bool on) { tracing.store(on, std::memory_order_relaxed); }
+    bool isTracing() const { return tracing.load(std::memory_order_relaxed); }
+#endif
+
+    void add(Counter c, quint64 n = 1) {
+        if (isEnabled())
+            counts[c].fetch_add(n, std::memory_order_relaxed);
+    }
+    quint64 value(Counter c) const { return counts[c].load(std::memory_order_relaxed); }
+
+    // Any thread: one read() that returned n > 0 bytes.
+    void read(qint64 n) {
+        if (!isEnabled())
+            return;
+        counts[ReadCalls].fetch_add(1, std::memory_order_relaxed);
+        counts[BytesRead].fetch_add(quint64(n), std::memory_order_relaxed);
+    }
+
+    // Parsing thread: bytes about to be handed to the emulator.
+    void parsed(const char *data, size_t len) {
+        if (!isEnabled())
+            return;
+        quint64 found[CounterCount] = {};
+        for (size_t i = 0; i < len; ++i)
+            scan(uchar(data[i]), found);
+        found[BytesParsed] = len;
+        for (int c = BytesParsed; c <= CellsWritten; ++c)
+            if (found[c])
+                counts[c].fetch_add(found[c], std::memory_order_relaxed);
+    }
+
+    // GUI thread, at the end of paintEvent.
+    void painted(qint64 startNs, quint64 cells) {
+        if (!isEnabled() && !isTracing())
+            return;
+        qint64 end = now();
+        add(FramesPainted);
+        add(CellsPainted, cells);
+        add(PaintNs, quint64(end - startNs));
+        span("paint", startNs, end, qint64(cells));
+    }
+
+    // Monotonic nanoseconds, for span starts; 0 when nothing is recorded.
+    qint64 now() const { return isEnabled() || isTracing() ? clock.nsecsElapsed() : 0; }
+
+    // A finished span on the calling thread; arg shows up as args.n.
+    void span(const char *name, qint64 startNs, qint64 endNs, qint64 arg = 0) {
+        if (!isTracing())
+            return;
+        Span s = { name, startNs, endNs - startNs, quintptr(QThread::currentThreadId()), arg };
+        QMutexLocker lock(&traceLock);
+        if (trace.size() < TraceCapacity) {
+            trace.append(s);
+        } else {
+            trace[traceNext] = s;
+            traceNext = (traceNext + 1) % TraceCapacity;
+        }
+    }
+
+    void reset() {
+        for (std::atomic<quint64> &c : counts)
+            c.store(0, std::memory_order_relaxed);
+        QMutexLocker lock(&traceLock);
+        trace.clear();
+        traceNext = 0;
+    }
+
+    // One counter per line, with paint time in microseconds.
+    QString report() const {
+        static const char *const names[CounterCount] = {
+            "bytes_read", "read_calls",
+            "bytes_parsed", "control_codes", "esc_sequences", "csi_sequences", "osc_sequences", "dcs_sequences",
+            "cells_written", "lines_scrolled",
+            "frames_painted", "cells_painted", "paint_ns",
+            "frames_coalesced", "frames_dropped",
+        };
+        QString out;
+        for (int c = 0; c < CounterCount; ++c)
+            out += QStringLiteral("%1%2\n").arg(QLatin1String(names[c]), -18).arg(value(Counter(c)), 14);
+        quint64 frames = value(FramesPainted);
+        if (frames)
+            out += QStringLiteral("%1%2\n").arg(QLatin1String("paint_us_per_frame"), -18)
+                       .arg(value(PaintNs) / 1e3 / frames, 14, 'f', 1);
+        return out;
+    }
+
+    // Chrome trace event format: complete ("X") events in microseconds.
+    QByteArray traceJson() const {
+        QJsonArray events;
+        QMutexLocker lock(&traceLock);
+        QVector<quintptr> threads;
+        for (int i = 0; i < trace.size(); ++i) {
+            const Span &s = trace[(traceNext + i) % trace.size()];
+            int tid = threads.indexOf(s.thread);
+            if (tid < 0) {
+                tid = threads.size();
+                threads.append(s.thread);
+            }
+            QJsonObject e;
+            e["name"] = QLatin1String(s.name);
+            e["ph"] = "X";
+            e["ts"] = s.start / 1e3;
+            e["dur"] = s.duration / 1e3;
+            e["pid"] = 1;
+            e["tid"] = tid;
+            e["args"] = QJsonObject{ { "n", s.arg } };
+            events.append(e);
+        }
+        QJsonObject doc;
+        doc["traceEvents"] = events;
+        doc["displayTimeUnit"] = "ms";
+        return QJsonDocument(doc).toJson(QJsonDocument::Compact);
+    }
+
+    bool writeTrace(const QString &path) const {
+        QFile f(path);
+        return f.open(QIODevice::WriteOnly | QIODevice::Truncate) && f.write(traceJson()) >= 0;
+    }
+
+private:
+    enum ScanState { Ground, Escape, EscIntermediate, Csi, String, StringEscape };
+
+    struct Span {
+        const char *name;
+        qint64 start, duration;
+        quintptr thread;
+        qint64 arg;
+    };
+
+    // Only as much of the VT500 state diagram as it takes to tell where a
+    // sequence starts and ends.
+    void scan(uchar b, quint64 *found) {
+        if (b == 0x18 || b == 0x1A) {           // CAN, SUB
+            scanState = Ground;
+            return;
+        }
+        switch (scanState) {
+        case Ground:
+            if (b == 0x1B)
+                scanState = Escape;
+            else if (b < 0x20 || b == 0x7F)
+                ++found[ControlCodes];
+            else if ((b & 0xC0) != 0x80)        // one per character, not per byte
+                ++found[CellsWritten];
+            return;
+        case StringEscape:
+            if (b == '\\') {                    // ST
+                scanState = Ground;
+                return;
+            }
+            Q_FALLTHROUGH();                    // a new sequence cut the string short
+        case Escape:
+            if (b == '[') {
+                ++found[CsiSequences];
+                scanState = Csi;
+            } else if (b == ']') {
+                ++found[OscSequences];
+                scanState = String;
+            } else if (b == 'P') {
+                ++found[DcsSequences];
+                scanState = String;
+            } else if (b == 'X' || b == '^' || b == '_') {
+                ++found[EscSequences];          // SOS, PM, APC
+                scanState = String;
+            } else if (b == 0x1B) {
+                scanState = Escape;
+            } else if (b >= 0x20 && b < 0x30) {
+                scanState = EscIntermediate;
+            } else {
+                ++found[EscSequences];
+                scanState = Ground;
+            }
+            return;
+        case EscIntermediate:
+            if (b >= 0x30 && b < 0x7F) {
+                ++found[EscSequences];
+                scanState = Ground;
+            }
+            return;
+        case Csi:
+            if (b == 0x1B)
+                scanState = Escape;
+            else if (b >= 0x40 && b < 0x7F)
+                scanState = Ground;
+            return;
+        case String:
+            if (b == 0x07)
+                scanState = Ground;
+            else if (b == 0x1B)
+                scanState = StringEscape;
+            return;
+        }
+    }
+
+    QElapsedTimer clock;
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> tracing{false};
+    std::atomic<quint64> counts[CounterCount];
+    ScanState scanState = Ground;       // parsing thread only
+
+    mutable QMutex traceLock;
+    QVector<Span> trace;
+    int traceNext = 0;                  // oldest span once the ring is full
+};
+
+#endif // PERFCOUNTERS_H
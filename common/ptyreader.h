@@ -0,0 +1,161 @@
+// ptyreader.h — background thread that owns reads from a PTY master fd.
+//
+// The thread reads the (non-blocking) master into an SpscByteRing and calls
+// the data callback — on the reader thread — when the consumer should come
+// and drain it. To keep wakeups down the callback fires only when
+//   * the queued bytes cross notifyThreshold, or
+//   * notifyInterval has passed since the previous notification
+//     (so the first byte after an idle period is delivered at once),
+// and never again until the consumer calls acknowledge().
+//
+// When the ring is full the thread stops reading, which leaves the data in
+// the kernel and back-pressures the child instead of dropping output.
+
+#ifndef PTYREADER_H
+#define PTYREADER_H
+
+#include <QThread>
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <functional>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "perfcounters.h"
+#include "spscring.h"
+
+class PtyReader : public QThread {
+public:
+    explicit PtyReader(int fd, size_t ringCapacity = 4 << 20)
+        : masterFd(fd), buffer(ringCapacity) {
+        if (pipe(wakePipe) == 0) {
+            fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+            fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+        }
+    }
+
+    ~PtyReader() override {
+        stop();
+        ::close(wakePipe[0]);
+        ::close(wakePipe[1]);
+    }
+
+    SpscByteRing &ring() { return buffer; }
+
+    // Configure before start().
+    void setNotifyThreshold(size_t bytes) { threshold = bytes; }
+    void setNotifyInterval(int msec) { interval = msec; }
+    // Reads are counted here; none if null.
+    void setCounters(PerfCounters *c) { counters = c; }
+
+    // Called on the reader thread; typically posts a queued call to the
+    // GUI thread.
+    void setDataCallback(std::function<void()> cb) { onData = std::move(cb); }
+
+    // Consumer side: call after draining. Re-arms the callback and wakes the
+    // reader if data is still queued or it was waiting for ring space.
+    void acknowledge() {
+        signalled.store(false, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!buffer.isEmpty() || waitingForSpace.load(std::memory_order_relaxed))
+            wake();
+    }
+
+    // True once the child closed its side; no more data will arrive.
+    bool atEof() const { return eof.load(std::memory_order_acquire); }
+
+    void stop() {
+        if (!isRunning())
+            return;
+        stopping.store(true);
+        wake();
+        wait();
+    }
+
+protected:
+    void run() override {
+        QElapsedTimer clock;
+        clock.start();
+        qint64 lastNotify = -interval;
+
+        while (!stopping.load()) {
+            bool full = false;
+            while (!eof.load(std::memory_order_relaxed)) {
+                size_t len;
+                char *dst = buffer.writeSpan(&len);
+                if (!len) {
+                    full = true;
+                    break;
+                }
+                ssize_t n = ::read(masterFd, dst, len);
+                if (n > 0) {
+                    if (counters)
+                        counters->read(n);
+                    buffer.commitWrite(n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n == 0 || errno != EAGAIN)
+                    eof.store(true, std::memory_order_release);
+                break;
+            }
+            waitingForSpace.store(full, std::memory_order_relaxed);
+
+            // Pairs with the fence in acknowledge(): either we see the
+            // cleared flag or the consumer sees our data and wakes us.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            int timeout = -1;
+            size_t queued = buffer.size();
+            if ((queued || eof.load(std::memory_order_relaxed)) && !signalled.load(std::memory_order_relaxed)) {
+                qint64 since = clock.elapsed() - lastNotify;
+                if (queued >= threshold || since >= interval || eof.load(std::memory_order_relaxed)) {
+                    signalled.store(true, std::memory_order_relaxed);
+                    lastNotify = clock.elapsed();
+                    if (onData)
+                        onData();
+                } else {
+                    timeout = int(interval - since);
+                }
+            }
+
+            // After EOF only the wake pipe matters (acknowledge/stop).
+            struct pollfd fds[2] = {
+                { wakePipe[0], POLLIN, 0 },
+                { masterFd, POLLIN, 0 },
+            };
+            nfds_t nfds = (full || eof.load(std::memory_order_relaxed)) ? 1 : 2;
+            if (poll(fds, nfds, timeout) > 0 && (fds[0].revents & POLLIN)) {
+                char sink[64];
+                while (::read(wakePipe[0], sink, sizeof(sink)) > 0) {}
+            }
+        }
+    }
+
+private:
+    void wake() {
+        char c = 0;
+        ssize_t r = ::write(wakePipe[1], &c, 1);
+        (void)r; // a full pipe already guarantees a wakeup
+    }
+
+    int masterFd;
+    int wakePipe[2] = { -1, -1 };
+    SpscByteRing buffer;
+    std::function<void()> onData;
+    PerfCounters *counters = nullptr;
+    size_t threshold = 64 * 1024;
+    int interval = 8;
+
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> signalled{false};
+    std::atomic<bool> waitingForSpace{false};
+    std::atomic<bool> eof{false};
+};
+
+#endif // PTYREADER_H
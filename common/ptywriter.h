@@ -0,0 +1,120 @@
+// ptywriter.h — queued, non-blocking writes of input to a PTY master fd.
+//
+// write() never touches the fd: it appends to a queue and arms a zero-delay
+// timer, so everything produced in one event loop iteration (auto-repeat,
+// a pasted block, several events delivered together) goes out in a single
+// writev(). What the kernel does not take stays queued, and a write
+// QSocketNotifier resumes when the child has read some of it. A child that
+// stops reading therefore only grows the queue; nothing is dropped and the
+// GUI thread never blocks.
+//
+// pendingBytes() and the drained callback let a large producer (a
+// multi-megabyte paste, say) feed the queue in pieces instead of all at
+// once. After a write error other than EAGAIN (the child is gone) queued
+// and further input is discarded.
+//
+// GUI thread only.
+
+#ifndef PTYWRITER_H
+#define PTYWRITER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <functional>
+
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+class PtyWriter {
+public:
+    enum { MaxIov = 64 };
+
+    explicit PtyWriter(int fd) : masterFd(fd), notifier(fd, QSocketNotifier::Write) {
+        notifier.setEnabled(false);
+        QObject::connect(&notifier, &QSocketNotifier::activated, [this]() { flush(); });
+        timer.setSingleShot(true);
+        QObject::connect(&timer, &QTimer::timeout, [this]() { flush(); });
+    }
+
+    void write(const QByteArray &data) {
+        if (failed || data.isEmpty())
+            return;
+        queue.append(data);
+        pending += data.size();
+        // Waiting for the notifier already means the next flush is due.
+        if (!timer.isActive() && !notifier.isEnabled())
+            timer.start(0);
+    }
+    void write(const char *data, int len) { write(QByteArray(data, len)); }
+
+    // Bytes queued and not yet taken by the kernel.
+    qint64 pendingBytes() const { return pending; }
+
+    // Called after a flush that wrote bytes, e.g. to timestamp them.
+    void setWrittenCallback(std::function<void()> cb) { onWritten = std::move(cb); }
+    // Called when the queue runs empty.
+    void setDrainedCallback(std::function<void()> cb) { onDrained = std::move(cb); }
+
+private:
+    void flush() {
+        bool wrote = false;
+        while (!queue.isEmpty()) {
+            struct iovec iov[MaxIov];
+            int n = 0;
+            for (int i = 0; i < queue.size() && n < MaxIov; ++i, ++n) {
+                const QByteArray &chunk = queue.at(i);
+                int skip = i ? 0 : headOffset;
+                iov[n].iov_base = const_cast<char *>(chunk.constData()) + skip;
+                iov[n].iov_len = size_t(chunk.size() - skip);
+            }
+            ssize_t w = ::writev(masterFd, iov, n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0 && errno == EAGAIN)
+                break;
+            if (w < 0) {
+                failed = true;
+                queue.clear();
+                pending = 0;
+                headOffset = 0;
+                break;
+            }
+            wrote = wrote || w > 0;
+            consume(w);
+        }
+        notifier.setEnabled(!queue.isEmpty());
+        if (wrote && onWritten)
+            onWritten();
+        if (queue.isEmpty() && !failed && onDrained)
+            onDrained();
+    }
+
+    void consume(qint64 n) {
+        pending -= n;
+        while (n > 0) {
+            qint64 left = queue.first().size() - headOffset;
+            if (n < left) {
+                headOffset += int(n);
+                return;
+            }
+            n -= left;
+            queue.removeFirst();
+            headOffset = 0;
+        }
+    }
+
+    int masterFd;
+    QSocketNotifier notifier;
+    QTimer timer;
+    QList<QByteArray> queue;
+    int headOffset = 0;             // bytes of queue.first() already written
+    qint64 pending = 0;
+    bool failed = false;
+    std::function<void()> onWritten;
+    std::function<void()> onDrained;
+};
+
+#endif // PTYWRITER_H
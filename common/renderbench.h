@@ -0,0 +1,133 @@
+// renderbench.h — times a terminal widget's paintEvent on fixed screens.
+//
+// Each fixture is loaded straight into the widget's cells, bypassing the
+// parser, and the widget is rendered into a QImage with QWidget::render(),
+// which calls paintEvent() directly and leaves out the window background
+// and child widgets. Every fixture is timed as full frames and as frames
+// where a single row is dirty, with and without the glyph atlas, so the
+// cost of drawText()/setFont() per cell shows up next to the atlas path.
+//
+// Meant to run under QT_QPA_PLATFORM=offscreen. The widget is shown (no
+// event loop runs during the measurement) and resized per fixture; what
+// was on its screen is lost. The report is JSON with microseconds per
+// frame.
+
+#ifndef RENDERBENCH_H
+#define RENDERBENCH_H
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+#include <QWidget>
+#include <functional>
+
+#include "cellgrid.h"
+
+struct RenderFixture {
+    QString name;
+    int rows, cols;
+    std::function<PackedCell(int y, int x)> cell;
+};
+
+class RenderBench {
+public:
+    enum { DefaultFrames = 100 };
+
+    // The loader puts a fixture on the widget's screen and resizes the
+    // widget to exactly fixture.rows x fixture.cols cells.
+    typedef std::function<void(const RenderFixture &)> Loader;
+
+    RenderBench(QWidget *w, const QString &name, Loader loader, std::function<void(bool)> setAtlas)
+        : widget(w), widgetName(name), load(std::move(loader)), atlas(std::move(setAtlas)) {}
+
+    static QVector<RenderFixture> fixtures() {
+        return {
+            { "blank", 24, 80, [](int, int) { return PackedCell::blank(); } },
+            { "ascii", 24, 80, [](int y, int x) { return text(y, x, 0, CellColor::Default, CellColor::Default); } },
+            // Runs of eight cells per colour, as from syntax highlighting.
+            { "colour", 24, 80, colour },
+            // No two neighbouring cells share attributes or colours.
+            { "styles", 24, 80, [](int y, int x) {
+                  return text(y, x, (x + y) % 16, CellColor::rgb(x * 3, y * 10, 255 - x),
+                              (x + y) % 3 ? CellColor::Default : CellColor::indexed(x % 256));
+              } },
+            { "large", 100, 300, colour },
+        };
+    }
+
+    QByteArray run(int frames = DefaultFrames) {
+        frames = qMax(frames, 1);
+        widget->show();
+        QJsonArray results;
+        for (const RenderFixture &f : fixtures()) {
+            load(f);
+            qreal dpr = widget->devicePixelRatioF();
+            QImage image(widget->size() * dpr, QImage::Format_ARGB32_Premultiplied);
+            image.setDevicePixelRatio(dpr);
+            int rowHeight = widget->height() / f.rows;
+            for (bool on : { true, false }) {
+                atlas(on);
+                render(&image, widget->rect());   // warms up the atlas and font caches
+
+                QElapsedTimer timer;
+                timer.start();
+                for (int i = 0; i < frames; ++i)
+                    render(&image, widget->rect());
+                qint64 fullNs = timer.nsecsElapsed();
+
+                timer.start();
+                for (int i = 0; i < frames; ++i)
+                    render(&image, QRect(0, i % f.rows * rowHeight, widget->width(), rowHeight));
+                qint64 rowNs = timer.nsecsElapsed();
+
+                QJsonObject r;
+                r["widget"] = widgetName;
+                r["fixture"] = f.name;
+                r["rows"] = f.rows;
+                r["columns"] = f.cols;
+                r["glyph_atlas"] = on;
+                r["frames"] = frames;
+                r["full_frame_us"] = fullNs / 1e3 / frames;
+                r["dirty_row_frame_us"] = rowNs / 1e3 / frames;
+                results.append(r);
+            }
+        }
+        atlas(true);
+
+        QJsonObject report;
+        report["benchmark"] = "render";
+        report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+        report["qt_version"] = qVersion();
+        report["platform"] = QGuiApplication::platformName();
+        report["device_pixel_ratio"] = widget->devicePixelRatioF();
+        report["results"] = results;
+        return QJsonDocument(report).toJson();
+    }
+
+private:
+    static PackedCell text(int y, int x, int attrs, quint32 fg, quint32 bg) {
+        return PackedCell::make(uint('!' + (x * 7 + y) % 94), attrs, fg, bg);
+    }
+
+    static PackedCell colour(int y, int x) {
+        int run = x / 8 + y;
+        return text(y, x, 0, CellColor::indexed(run % 256), run % 4 ? CellColor::Default : CellColor::indexed((run * 5) % 256));
+    }
+
+    void render(QImage *image, const QRect &area) {
+        widget->render(image, area.topLeft(), QRegion(area), QWidget::RenderFlags());
+    }
+
+    QWidget *widget;
+    QString widgetName;
+    Loader load;
+    std::function<void(bool)> atlas;
+};
+
+#endif // RENDERBENCH_H
@@ -0,0 +1,425 @@
+// scrollback.h — compressed history of lines scrolled off the screen.
+//
+// Lines are appended oldest first and stored in segments of SegmentLines
+// lines. Each line is run-length encoded by attributes: a run header
+// (length, attribute bits, colours as varints) followed by the run's code
+// points as UTF-8, with trailing blank cells dropped. Typical text costs
+// a few bytes of header per line plus one byte per character. A full
+// segment is sealed with qCompress(), which shrinks text several times
+// more. The open segment stays uncompressed so appending is cheap.
+//
+// Memory is capped in bytes, not lines: once the cap is exceeded the
+// oldest segments are dropped whole, or, with a spill file, appended to
+// it. The file is append-only and memory-mapped for reading; since every
+// spilled segment holds exactly SegmentLines lines, an array of record
+// offsets finds any line's segment in O(1), and only the pages of
+// segments actually read are faulted in. Reading a line decompresses its
+// segment once; the last decompressed segment is cached, so paging
+// through history decompresses each segment once.
+//
+// A spill file kept on close can be reopened later: its full segments are
+// indexed by a quick scan of the record headers and the trailing partial
+// one is loaded back into memory.
+//
+// Not thread-safe; the owner serializes push() and line().
+
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QList>
+#include <QRandomGenerator>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+
+#include "cellgrid.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+class Scrollback {
+public:
+    enum { SegmentLines = 256 };
+    static constexpr qint64 DefaultMaxBytes = 64 * 1024 * 1024;
+
+    enum SpillMode { RemoveOnClose, KeepOnClose };
+
+    explicit Scrollback(qint64 maxBytes = DefaultMaxBytes) { setMaxBytes(maxBytes); }
+    ~Scrollback() { closeSpill(); }
+
+    // At least a few segments are always kept, whatever the cap.
+    void setMaxBytes(qint64 bytes) {
+        cap = qMax<qint64>(bytes, 256 * 1024);
+        trim();
+    }
+    qint64 maxBytes() const { return cap; }
+    qint64 bytesUsed() const { return used + open.size(); }
+
+    // Lines currently held, in memory and spilled; line(0) is the oldest.
+    int lineCount() const { return spilledLines() + sealedLines + openOffsets.size(); }
+    // Lines dropped from the front since the last clear(), so callers can
+    // keep an absolute position stable while history is trimmed.
+    qint64 droppedLines() const { return dropped; }
+
+    // From now on segments past the memory cap are appended to the file at
+    // path instead of being dropped. With KeepOnClose an existing history
+    // file there is reopened and becomes the whole history; what was held
+    // before is discarded. With RemoveOnClose the file must not exist yet:
+    // it is created exclusively, readable by the owner only, so a planted
+    // file or symlink, or one left by a crashed session, is never adopted.
+    // Returns false, and keeps dropping, if the file cannot be used. A later
+    // write error ends spilling the same way; the lines already in the file
+    // then count as dropped.
+    bool setSpillFile(const QString &path, SpillMode mode = RemoveOnClose) {
+        closeSpill();
+        clear();
+        spill.setFileName(path);
+        if (mode == RemoveOnClose) {
+            int fd = ::open(QFile::encodeName(path).constData(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            if (fd < 0)
+                return false;
+            if (!spill.open(fd, QIODevice::ReadWrite, QFileDevice::AutoCloseHandle)) {
+                ::close(fd);
+                QFile::remove(path);
+                return false;
+            }
+        } else if (!spill.open(QIODevice::ReadWrite)) {
+            return false;
+        }
+        spillMode = mode;
+        // Something that is not a history file is left alone.
+        if ((mode == KeepOnClose && spill.size()) ? !reopenSpill() : !resetSpill()) {
+            spill.close();
+            if (mode == RemoveOnClose)
+                QFile::remove(spill.fileName());   // the handle came from open(2), so go by name
+            return false;
+        }
+        return true;
+    }
+    QString spillFile() const { return spill.isOpen() ? spill.fileName() : QString(); }
+
+    // A fresh, unguessable name in $XDG_RUNTIME_DIR, or the temp directory,
+    // for use with RemoveOnClose.
+    static QString defaultSpillPath() {
+        QString dir = qEnvironmentVariable("XDG_RUNTIME_DIR");
+        if (dir.isEmpty())
+            dir = QDir::tempPath();
+        return QDir(dir).filePath(QStringLiteral("qterminal-scrollback-%1-%2.bin")
+                                      .arg(QCoreApplication::applicationPid())
+                                      .arg(QRandomGenerator::system()->generate64(), 16, 16, QLatin1Char('0')));
+    }
+
+    void clear() {
+        if (spill.isOpen())
+            resetSpill();
+        segments.clear();
+        open.clear();
+        openOffsets.clear();
+        used = 0;
+        sealedLines = 0;
+        dropped = 0;
+        cachedSegment = -1;
+    }
+
+    void push(const PackedCell *cells, int count) {
+        while (count > 0 && isPlain(cells[count - 1]))
+            --count;
+        openOffsets.append(open.size());
+        encodeLine(cells, count, &open);
+        if (openOffsets.size() >= SegmentLines)
+            seal();
+        trim();
+    }
+
+    // Decodes line i into *out, resized to the stored cell count (trailing
+    // blanks are not stored; treat missing cells as blank).
+    void line(int i, QVector<PackedCell> *out) const {
+        out->resize(0);
+        if (i < 0 || i >= lineCount())
+            return;
+        if (i >= spilledLines() + sealedLines) {
+            int k = i - spilledLines() - sealedLines;
+            int end = k + 1 < openOffsets.size() ? openOffsets[k + 1] : open.size();
+            decodeLine(open.constData() + openOffsets[k], open.constData() + end, out);
+            return;
+        }
+        int seg = i / SegmentLines;
+        if (seg != cachedSegment) {
+            cachedData = seg < spillIndex.size() ? readSpilled(seg)
+                                                 : qUncompress(segments[seg - spillIndex.size()]);
+            cachedOffsets.resize(0);
+            const char *p = cachedData.constData(), *end = p + cachedData.size();
+            while (p < end) {
+                cachedOffsets.append(int(p - cachedData.constData()));
+                p = skipLine(p, end);
+            }
+            cachedSegment = seg;
+        }
+        int k = i % SegmentLines;
+        if (k >= cachedOffsets.size())
+            return;
+        int end = k + 1 < cachedOffsets.size() ? cachedOffsets[k + 1] : cachedData.size();
+        decodeLine(cachedData.constData() + cachedOffsets[k], cachedData.constData() + end, out);
+    }
+
+private:
+    static bool isPlain(const PackedCell &c) {
+        return c.isBlank() && c.attrs == 0 && c.bg == CellColor::Default;
+    }
+
+    void seal() {
+        QByteArray packed = qCompress(open, 1);
+        used += packed.size();
+        segments.append(packed);
+        sealedLines += openOffsets.size();
+        open.resize(0);
+        openOffsets.resize(0);
+    }
+
+    void trim() {
+        while (bytesUsed() > cap && !segments.isEmpty()) {
+            // Spilling keeps every line's index, dropping shifts them all.
+            if (spill.isOpen() && !appendRecord(segments.first(), SegmentLines))
+                abandonSpill();
+            if (!spill.isOpen()) {
+                dropped += SegmentLines;
+                cachedSegment = -1;
+            }
+            used -= segments.first().size();
+            segments.removeFirst();
+            sealedLines -= SegmentLines;
+        }
+    }
+
+    // Spill file: an 8-byte header, then records of (quint32 line count,
+    // quint32 size, size bytes of qCompress()ed segment).
+    enum { SpillHeaderSize = 8 };
+    static const char *spillMagic() { return "QTSB\1\0\0\0"; }
+
+    int spilledLines() const { return spillIndex.size() * SegmentLines; }
+
+    bool appendRecord(const QByteArray &data, int lines) {
+        qint64 at = spill.size();
+        quint32 header[2] = { quint32(lines), quint32(data.size()) };
+        if (!spill.seek(at)
+            || spill.write(reinterpret_cast<const char *>(header), sizeof(header)) != qint64(sizeof(header))
+            || spill.write(data) != data.size()
+            || !spill.flush()) {
+            spill.resize(at);   // a torn record would end the file on reopen anyway
+            return false;
+        }
+        if (lines == SegmentLines)
+            spillIndex.append(at);
+        return true;
+    }
+
+    QByteArray readSpilled(int seg) const {
+        qint64 at = spillIndex[seg];
+        if (mappedSize < spill.size()) {
+            if (mapped)
+                spill.unmap(mapped);
+            mappedSize = spill.size();
+            mapped = spill.map(0, mappedSize);
+        }
+        if (!mapped)
+            return QByteArray();
+        quint32 header[2];
+        memcpy(header, mapped + at, sizeof(header));
+        return qUncompress(mapped + at + sizeof(header), int(header[1]));
+    }
+
+    bool resetSpill() {
+        unmapSpill();
+        spillIndex.clear();
+        return spill.resize(0) && spill.seek(0)
+            && spill.write(spillMagic(), SpillHeaderSize) == SpillHeaderSize && spill.flush();
+    }
+
+    // Index the full segments of an existing file and load a trailing
+    // partial one back as the open segment. A torn record is cut off.
+    bool reopenSpill() {
+        char magic[SpillHeaderSize];
+        if (spill.read(magic, SpillHeaderSize) != SpillHeaderSize || memcmp(magic, spillMagic(), SpillHeaderSize))
+            return false;
+        qint64 at = SpillHeaderSize, size = spill.size();
+        quint32 header[2];
+        while (spill.seek(at) && spill.read(reinterpret_cast<char *>(header), sizeof(header)) == qint64(sizeof(header))
+               && at + qint64(sizeof(header)) + header[1] <= size) {
+            if (header[0] != SegmentLines) {
+                open = qUncompress(spill.read(header[1]));
+                for (const char *p = open.constData(), *end = p + open.size(); p < end; p = skipLine(p, end))
+                    openOffsets.append(int(p - open.constData()));
+                break;
+            }
+            spillIndex.append(at);
+            at += sizeof(header) + header[1];
+        }
+        return spill.resize(at);
+    }
+
+    // A kept file gets everything still in memory, so reopening it restores
+    // the whole history.
+    void closeSpill() {
+        if (!spill.isOpen())
+            return;
+        if (spillMode == KeepOnClose) {
+            for (const QByteArray &seg : segments)
+                appendRecord(seg, SegmentLines);
+            if (!openOffsets.isEmpty())
+                appendRecord(qCompress(open, 1), openOffsets.size());
+        }
+        unmapSpill();
+        spill.close();
+        if (spillMode == RemoveOnClose)
+            QFile::remove(spill.fileName());
+        spillIndex.clear();
+    }
+
+    // After a failed write: stop spilling for good and count what the file
+    // held as dropped. Those are the oldest lines, so this only moves the
+    // front of the history, like dropping in memory does.
+    void abandonSpill() {
+        dropped += spilledLines();
+        unmapSpill();
+        spill.close();
+        if (spillMode == RemoveOnClose)
+            QFile::remove(spill.fileName());
+        spillIndex.clear();
+    }
+
+    void unmapSpill() {
+        if (mapped)
+            spill.unmap(mapped);
+        mapped = nullptr;
+        mappedSize = 0;
+        cachedSegment = -1;
+    }
+
+    // Colours as varints: kind in the low two bits, so the default colour
+    // and the first 64 palette entries take one byte.
+    static quint32 packColor(quint32 c) { return (c & 0xffffff) << 2 | (c >> 24 & 3); }
+    static quint32 unpackColor(quint32 v) { return (v & 3) << 24 | v >> 2; }
+
+    static void putVarint(QByteArray *out, quint32 v) {
+        while (v >= 0x80) {
+            out->append(char(v | 0x80));
+            v >>= 7;
+        }
+        out->append(char(v));
+    }
+
+    static quint32 getVarint(const char *&p, const char *end) {
+        quint32 v = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            uchar b = uchar(*p++);
+            v |= quint32(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        return v;
+    }
+
+    static void putUtf8(QByteArray *out, quint32 cp) {
+        if (cp < 0x80) {
+            out->append(char(cp));
+        } else if (cp < 0x800) {
+            out->append(char(0xc0 | cp >> 6));
+            out->append(char(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            out->append(char(0xe0 | cp >> 12));
+            out->append(char(0x80 | (cp >> 6 & 0x3f)));
+            out->append(char(0x80 | (cp & 0x3f)));
+        } else {
+            out->append(char(0xf0 | cp >> 18));
+            out->append(char(0x80 | (cp >> 12 & 0x3f)));
+            out->append(char(0x80 | (cp >> 6 & 0x3f)));
+            out->append(char(0x80 | (cp & 0x3f)));
+        }
+    }
+
+    // Only reads what putUtf8() wrote, so no validation is needed.
+    static quint32 getUtf8(const char *&p, const char *end) {
+        uchar b = uchar(*p++);
+        if (b < 0x80)
+            return b;
+        int extra = b >= 0xf0 ? 3 : b >= 0xe0 ? 2 : 1;
+        quint32 cp = b & (0x3f >> extra);
+        while (extra-- && p < end)
+            cp = cp << 6 | (uchar(*p++) & 0x3f);
+        return cp;
+    }
+
+    // Line: varint cell count, then runs of (varint length, attrs, fg, bg,
+    // length code points).
+    static void encodeLine(const PackedCell *cells, int count, QByteArray *out) {
+        putVarint(out, quint32(count));
+        int x = 0;
+        while (x < count) {
+            int end = x + 1;
+            while (end < count && cells[end].sameRun(cells[x]))
+                ++end;
+            putVarint(out, quint32(end - x));
+            putVarint(out, cells[x].attrs);
+            putVarint(out, packColor(cells[x].fg));
+            putVarint(out, packColor(cells[x].bg));
+            for (int i = x; i < end; ++i)
+                putUtf8(out, cells[i].ch ? quint32(cells[i].ch) : quint32(' '));
+            x = end;
+        }
+    }
+
+    static void decodeLine(const char *p, const char *end, QVector<PackedCell> *out) {
+        int count = int(getVarint(p, end));
+        out->resize(count);
+        PackedCell *cells = out->data();
+        int x = 0;
+        while (x < count && p < end) {
+            int len = qMin(int(getVarint(p, end)), count - x);
+            int attrs = int(getVarint(p, end));
+            quint32 fg = unpackColor(getVarint(p, end));
+            quint32 bg = unpackColor(getVarint(p, end));
+            for (int i = 0; i < len && p < end; ++i)
+                cells[x++] = PackedCell::make(getUtf8(p, end), attrs, fg, bg);
+        }
+        for (; x < count; ++x)
+            cells[x] = PackedCell::blank();
+    }
+
+    static const char *skipLine(const char *p, const char *end) {
+        int count = int(getVarint(p, end));
+        while (count > 0 && p < end) {
+            int len = int(getVarint(p, end));
+            getVarint(p, end);
+            getVarint(p, end);
+            getVarint(p, end);
+            for (int i = 0; i < len && p < end; ++i)
+                getUtf8(p, end);
+            count -= qMax(len, 1);
+        }
+        return p;
+    }
+
+    QList<QByteArray> segments;     // sealed, qCompress()ed
+    QByteArray open;                // segment being filled
+    QVector<int> openOffsets;       // start of each line in open
+    qint64 used = 0;                // bytes in segments
+    qint64 cap = DefaultMaxBytes;
+    int sealedLines = 0;           // in segments
+    qint64 dropped = 0;
+
+    mutable QFile spill;
+    SpillMode spillMode = RemoveOnClose;
+    QVector<qint64> spillIndex;     // offset of each spilled segment's record
+    mutable uchar *mapped = nullptr;
+    mutable qint64 mappedSize = 0;
+
+    mutable int cachedSegment = -1;
+    mutable QByteArray cachedData;
+    mutable QVector<int> cachedOffsets;
+};
+
+#endif // SCROLLBACK_H
@@ -0,0 +1,107 @@
+// spscring.h — lock-free single-producer/single-consumer byte ring.
+//
+// Exactly one thread may use the producer side (writeSpan/commitWrite/write)
+// and exactly one other thread the consumer side (readSpan/commitRead/read).
+// Head and tail are free-running counters, so the ring never needs a spare
+// slot to tell "full" from "empty".
+
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+class SpscByteRing {
+public:
+    explicit SpscByteRing(size_t capacity = 1 << 20) {
+        size_t cap = 4096;
+        while (cap < capacity)
+            cap <<= 1;
+        buf.reset(new char[cap]);
+        mask = cap - 1;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // Bytes currently queued. Exact on the consumer side, a lower bound of
+    // free space on the producer side.
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    bool isEmpty() const { return size() == 0; }
+
+    // Producer: largest contiguous free region, to read() straight into.
+    char *writeSpan(size_t *len) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t free = capacity() - (h - tail.load(std::memory_order_acquire));
+        size_t off = h & mask;
+        *len = free < capacity() - off ? free : capacity() - off;
+        return buf.get() + off;
+    }
+
+    void commitWrite(size_t n) {
+        head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    size_t write(const char *data, size_t n) {
+        size_t done = 0;
+        while (done < n) {
+            size_t len;
+            char *dst = writeSpan(&len);
+            if (!len)
+                break;
+            if (len > n - done)
+                len = n - done;
+            memcpy(dst, data + done, len);
+            commitWrite(len);
+            done += len;
+        }
+        return done;
+    }
+
+    // Consumer: largest contiguous queued region, valid until commitRead().
+    const char *readSpan(size_t *len) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t avail = head.load(std::memory_order_acquire) - t;
+        size_t off = t & mask;
+        *len = avail < capacity() - off ? avail : capacity() - off;
+        return buf.get() + off;
+    }
+
+    void commitRead(size_t n) {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    size_t read(char *out, size_t n) {
+        size_t done = 0;
+        while (done < n) {
+            size_t len;
+            const char *src = readSpan(&len);
+            if (!len)
+                break;
+            if (len > n - done)
+                len = n - done;
+            memcpy(out + done, src, len);
+            commitRead(len);
+            done += len;
+        }
+        return done;
+    }
+
+private:
+    std::unique_ptr<char[]> buf;
+    size_t mask = 0;
+
+    // Keep the two indices on separate cache lines so the producer and the
+    // consumer do not bounce one line between cores on every commit.
+    char pad0[64];
+    std::atomic<size_t> head{0};
+    char pad1[64];
+    std::atomic<size_t> tail{0};
+    char pad2[64];
+};
+
+#endif // SPSCRING_H
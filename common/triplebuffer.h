@@ -0,0 +1,48 @@
+// triplebuffer.h — lock-free triple buffer for handing whole frames from one
+// writer thread to one reader thread.
+//
+// The writer fills back() and publish()es it; the reader calls acquire() to
+// pick up the newest published frame and then reads front() for as long as
+// it likes. Neither side ever waits for the other: the writer always has a
+// free slot and the reader keeps its slot until it acquires again.
+// Intermediate frames the reader was too slow for are simply skipped;
+// publish() reports when that happens.
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+public:
+    // Writer side.
+    T &back() { return slots[backIndex]; }
+
+    // Returns true if it replaced a frame the reader never acquired.
+    bool publish() {
+        int old = middle.exchange(backIndex | Fresh, std::memory_order_acq_rel);
+        backIndex = old & IndexMask;
+        return old & Fresh;
+    }
+
+    // Reader side. Returns true if front() changed.
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & Fresh))
+            return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    const T &front() const { return slots[frontIndex]; }
+
+private:
+    enum { IndexMask = 3, Fresh = 4 };
+
+    T slots[3];
+    int backIndex = 0;              // owned by the writer
+    int frontIndex = 1;             // owned by the reader
+    std::atomic<int> middle{2};     // shared: slot index plus Fresh flag
+};
+
+#endif // TRIPLEBUFFER_H
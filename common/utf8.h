@@ -0,0 +1,193 @@
+/* utf8.h — incremental, locale-independent UTF-8 decoder.
+ *
+ * Usable from C (tmt.c) and C++. Decoding follows the WHATWG Encoding
+ * standard: every maximal invalid subsequence becomes one U+FFFD and the
+ * byte that ended it is decoded afresh, so the output never depends on
+ * setlocale() and errors cannot swallow the text that follows them.
+ *
+ * utf8_step() consumes one byte at a time and keeps a partial sequence
+ * across calls, which is all a terminal needs when escape processing is
+ * interleaved byte by byte. utf8_decode() is the bulk path: ASCII stretches
+ * are widened 16 bytes at a time with SSE2, and multi-byte sequences that
+ * are complete in the buffer are validated and decoded whole; only a
+ * sequence split across buffers goes through the byte state machine.
+ */
+
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define UTF8_REPLACEMENT 0xfffdu
+
+/* utf8_step() results that are not code points. */
+#define UTF8_NEED_MORE   0xffffffffu
+
+/* All-zero is the initial state, so calloc()ed or value-initialized
+ * decoders need no setup.
+ */
+typedef struct utf8_decoder{
+    uint32_t cp;            /* bits collected so far */
+    unsigned char need;     /* continuation bytes still expected */
+    unsigned char raise;    /* next continuation byte must be >= 0x80 + raise */
+    unsigned char cut;      /* ... and <= 0xbf - cut */
+} utf8_decoder;
+
+static inline void
+utf8_init(utf8_decoder *d)
+{
+    d->cp = 0;
+    d->need = d->raise = d->cut = 0;
+}
+
+static inline int
+utf8_idle(const utf8_decoder *d)
+{
+    return d->need == 0;
+}
+
+/* Feed one byte. Returns a code point, or UTF8_NEED_MORE. When an invalid
+ * sequence is cut short by b, U+FFFD is returned and *again is set: the
+ * caller must feed the same byte once more.
+ */
+static inline uint32_t
+utf8_step(utf8_decoder *d, unsigned char b, int *again)
+{
+    *again = 0;
+    if (!d->need){
+        if (b < 0x80)
+            return b;
+        if (b >= 0xc2 && b <= 0xdf){
+            d->need = 1;
+            d->cp = b & 0x1f;
+        } else if (b >= 0xe0 && b <= 0xef){
+            if (b == 0xe0) d->raise = 0x20;  /* overlong */
+            if (b == 0xed) d->cut = 0x20;    /* surrogates */
+            d->need = 2;
+            d->cp = b & 0x0f;
+        } else if (b >= 0xf0 && b <= 0xf4){
+            if (b == 0xf0) d->raise = 0x10;  /* overlong */
+            if (b == 0xf4) d->cut = 0x30;    /* above U+10FFFF */
+            d->need = 3;
+            d->cp = b & 0x07;
+        } else
+            return UTF8_REPLACEMENT;
+        return UTF8_NEED_MORE;
+    }
+
+    if (b < 0x80 + d->raise || b > 0xbf - d->cut){
+        utf8_init(d);
+        *again = 1;
+        return UTF8_REPLACEMENT;
+    }
+    d->raise = d->cut = 0;
+    d->cp = (d->cp << 6) | (b & 0x3f);
+    if (--d->need)
+        return UTF8_NEED_MORE;
+    return d->cp;
+}
+
+/* End of input: a pending partial sequence becomes U+FFFD. Returns
+ * UTF8_NEED_MORE if nothing was pending.
+ */
+static inline uint32_t
+utf8_flush(utf8_decoder *d)
+{
+    if (utf8_idle(d))
+        return UTF8_NEED_MORE;
+    utf8_init(d);
+    return UTF8_REPLACEMENT;
+}
+
+/* Length of a complete, valid sequence starting at s, or 0 if the bytes
+ * available do not form one (the caller then falls back to utf8_step()).
+ */
+static inline size_t
+utf8_whole(const unsigned char *s, size_t n, uint32_t *cp)
+{
+    unsigned char b = s[0];
+    if (b >= 0xc2 && b <= 0xdf){
+        if (n < 2 || (s[1] & 0xc0) != 0x80) return 0;
+        *cp = ((uint32_t)(b & 0x1f) << 6) | (s[1] & 0x3f);
+        return 2;
+    }
+    if (b >= 0xe0 && b <= 0xef){
+        unsigned char lo = b == 0xe0? 0xa0 : 0x80, hi = b == 0xed? 0x9f : 0xbf;
+        if (n < 3 || s[1] < lo || s[1] > hi || (s[2] & 0xc0) != 0x80) return 0;
+        *cp = ((uint32_t)(b & 0x0f) << 12) | ((uint32_t)(s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+        return 3;
+    }
+    if (b >= 0xf0 && b <= 0xf4){
+        unsigned char lo = b == 0xf0? 0x90 : 0x80, hi = b == 0xf4? 0x8f : 0xbf;
+        if (n < 4 || s[1] < lo || s[1] > hi || (s[2] & 0xc0) != 0x80 || (s[3] & 0xc0) != 0x80) return 0;
+        *cp = ((uint32_t)(b & 0x07) << 18) | ((uint32_t)(s[1] & 0x3f) << 12)
+            | ((uint32_t)(s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+        return 4;
+    }
+    return 0;
+}
+
+/* Decode up to cap code points from src[0..n). Returns the number written
+ * to out; *consumed is set to the bytes used. A trailing partial sequence
+ * is kept in d for the next call. cap must be at least 2.
+ */
+static inline size_t
+utf8_decode(utf8_decoder *d, const char *src, size_t n,
+            uint32_t *out, size_t cap, size_t *consumed)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    size_t i = 0, o = 0;
+
+    while (i < n && o + 2 <= cap){
+        if (utf8_idle(d)){
+#if defined(__SSE2__)
+            while (i + 16 <= n && o + 16 <= cap){
+                __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+                if (_mm_movemask_epi8(v))
+                    break;
+                __m128i z = _mm_setzero_si128();
+                __m128i lo = _mm_unpacklo_epi8(v, z), hi = _mm_unpackhi_epi8(v, z);
+                _mm_storeu_si128((__m128i *)(out + o),      _mm_unpacklo_epi16(lo, z));
+                _mm_storeu_si128((__m128i *)(out + o + 4),  _mm_unpackhi_epi16(lo, z));
+                _mm_storeu_si128((__m128i *)(out + o + 8),  _mm_unpacklo_epi16(hi, z));
+                _mm_storeu_si128((__m128i *)(out + o + 12), _mm_unpackhi_epi16(hi, z));
+                i += 16;
+                o += 16;
+            }
+            if (i == n || o + 2 > cap)
+                break;
+#endif
+            if (s[i] < 0x80){
+                out[o++] = s[i++];
+                continue;
+            }
+            size_t len = utf8_whole(s + i, n - i, out + o);
+            if (len){
+                i += len;
+                o++;
+                continue;
+            }
+        }
+
+        int again;
+        uint32_t c = utf8_step(d, s[i], &again);
+        if (c != UTF8_NEED_MORE)
+            out[o++] = c;
+        if (again){
+            c = utf8_step(d, s[i], &again);
+            if (c != UTF8_NEED_MORE)
+                out[o++] = c;
+        }
+        i++;
+    }
+
+    *consumed = i;
+    return o;
+}
+
+#endif /* UTF8_H */
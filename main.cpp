@@ -5,10 +5,23 @@
 #include <QPainter>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QWheelEvent>
 #include <QTimer>
+#include <QSocketNotifier>
 #include <QFontDatabase>
 #include <QScrollBar>
-#include <QRegularExpression>
+
+#include "cellgrid.h"
+#include "framescheduler.h"
+#include "glyphatlas.h"
+#include "gridemulator.h"
+#include "historyview.h"
+#include "latencyprobe.h"
+#include "perfcounters.h"
+#include "renderbench.h"
+#include "ptyreader.h"
+#include "ptywriter.h"
+#include "scrollback.h"
 
 #if defined(__APPLE__)
 #include <util.h>
@@ -20,10 +33,15 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <signal.h>
+#include <errno.h>
 #include <sys/ioctl.h>
 
 constexpr int TERM_ROWS = 24;
 constexpr int TERM_COLS = 80;
+constexpr int READ_CHUNK = 64 * 1024;
+constexpr int DEFAULT_READ_BUDGET = 256 * 1024;
+constexpr QRgb DEFAULT_FG = 0xffffffff;
+constexpr QRgb DEFAULT_BG = 0xff000000;
 
 class TerminalWidget : public QWidget {
     Q_OBJECT
@@ -33,45 +51,190 @@ public:
         setFocusPolicy(Qt::StrongFocus);
         setMouseTracking(true);
         initFont();
+        initScrollBar();
+        frameScheduler.setCounters(&counters);
+        emulator.setScrollback(&scrollback);
+        emulator.setTitleCallback([this](const QString &title) { window()->setWindowTitle(title); });
         startPTY();
+        startReadNotifier();
         startTimer();
     }
 
     ~TerminalWidget() {
+        if (latency.isEnabled())
+            fputs(qPrintable(latency.report()), stderr);
+        if (counters.isEnabled())
+            fputs(qPrintable(counters.report()), stderr);
+        if (!traceFile.isEmpty())
+            counters.writeTrace(traceFile);
+        delete reader;
+        delete writer;
+        if (readNotifier)
+            readNotifier->setEnabled(false);
         if (pid > 0)
             kill(pid, SIGKILL);
         if (masterFd >= 0)
             ::close(masterFd);
     }
 
+    // Upper bound on PTY bytes consumed per wakeup so a flood of output
+    // cannot starve input and painting; whatever is left is read on the
+    // next event loop iteration.
+    void setReadBudget(int bytes) { budget = qMax(bytes, 1); }
+    int readBudget() const { return budget; }
+    int bytesReadLastFrame() const { return lastFrameBytes; }
+
+    // Optional mode where a background thread owns the PTY reads and queues
+    // output in a lock-free ring; the GUI thread only parses and paints, so
+    // a slow repaint no longer leaves the child blocked on a full PTY.
+    void setThreadedReads(bool on) {
+        if (masterFd < 0 || on == (reader != nullptr)) return;
+        if (on) {
+            readNotifier->setEnabled(false);
+            reader = new PtyReader(masterFd);
+            reader->setCounters(&counters);
+            reader->setDataCallback([this]() {
+                latency.outputRead();
+                QMetaObject::invokeMethod(this, [this]() { drainReader(); }, Qt::QueuedConnection);
+            });
+            reader->start();
+        } else {
+            reader->stop();
+            while (!reader->ring().isEmpty())
+                drainReader();
+            delete reader;
+            reader = nullptr;
+            readNotifier->setEnabled(true);
+        }
+    }
+    bool threadedReads() const { return reader != nullptr; }
+
+    // Output repaints are coalesced to at most one frame per interval:
+    // maxFramesPerSecond, or the display refresh rate when 0. In low-latency
+    // mode the first frame after an idle period is painted immediately.
+    void setMaxFramesPerSecond(int fps) { frameScheduler.setMaxFramesPerSecond(fps); }
+    int maxFramesPerSecond() const { return frameScheduler.maxFramesPerSecond(); }
+    void setLowLatencyFirstFrame(bool on) { frameScheduler.setLowLatencyFirstFrame(on); }
+    bool lowLatencyFirstFrame() const { return frameScheduler.lowLatencyFirstFrame(); }
+
+    // Cells are blitted from a cache of pre-rendered glyphs; disabling it
+    // falls back to one drawText() per run of same-attribute cells.
+    void setGlyphAtlasEnabled(bool on) { atlasEnabled = on; update(); }
+    bool glyphAtlasEnabled() const { return atlasEnabled; }
+
+    // Lines scrolled off the top are kept in a compressed history capped
+    // at this many bytes; the oldest lines are dropped first.
+    void setScrollbackLimit(qint64 bytes) { scrollback.setMaxBytes(bytes); }
+    qint64 scrollbackLimit() const { return scrollback.maxBytes(); }
+    int scrollbackLines() const { return scrollback.lineCount(); }
+
+    // Lines past the limit spill to a memory-mapped file instead of being
+    // dropped. With keep set, a file that already holds history is reopened
+    // and remapped, and the file is left on disk when the widget goes away;
+    // without it the file is created afresh and must not exist yet.
+    bool setScrollbackFile(const QString &path, bool keep = false) {
+        bool ok = scrollback.setSpillFile(path, keep ? Scrollback::KeepOnClose : Scrollback::RemoveOnClose);
+        history.reset();
+        syncHistory();
+        return ok;
+    }
+    QString scrollbackFile() const { return scrollback.spillFile(); }
+
+    // Queues bytes for the child as if typed; see ptywriter.h. Pastes of
+    // any size are fine: they are written as fast as the child reads.
+    void sendInput(const QByteArray &bytes) {
+        if (writer)
+            writer->write(bytes);
+    }
+
+    // Keystroke-to-paint latency per stage (see latencyprobe.h). While it
+    // is enabled, Ctrl+Shift+L prints the histograms to stderr, and so
+    // does closing the widget.
+    void setLatencyProbeEnabled(bool on) { latency.setEnabled(on); }
+    bool latencyProbeEnabled() const { return latency.isEnabled(); }
+    QString latencyReport() const { return latency.report(); }
+
+    // Pipeline counters and the per-frame trace (see perfcounters.h), both
+    // off until enabled here. Closing the widget prints the counters to
+    // stderr and writes the trace to the trace file, if one is set.
+    PerfCounters &perfCounters() { return counters; }
+    const PerfCounters &perfCounters() const { return counters; }
+    void setTraceFile(const QString &path) {
+        traceFile = path;
+        counters.setTracing(!path.isEmpty());
+    }
+
+    // History lines shown above the screen; 0 follows the live output.
+    int scrollOffset() const { return history.offset(); }
+    void scrollToBottom() { scrollBar->setValue(scrollBar->maximum()); }
+
+    // paintEvent timings on fixed screens, as JSON (see renderbench.h).
+    // Overwrites the screen.
+    QByteArray renderBenchmark(int frames = RenderBench::DefaultFrames) {
+        RenderBench bench(this, "grid", [this](const RenderFixture &f) {
+            resize(f.cols * charWidth + scrollBar->sizeHint().width(), f.rows * charHeight);
+            CellGrid &grid = emulator.cells();
+            for (int y = 0; y < grid.rows(); ++y)
+                for (int x = 0; x < grid.columns(); ++x)
+                    grid.at(y, x) = f.cell(y, x);
+        }, [this](bool on) { setGlyphAtlasEnabled(on); });
+        return bench.run(frames);
+    }
+
+signals:
+    void outputConsumed(int bytes);
+
 protected:
     void paintEvent(QPaintEvent *) override {
+        latency.paintStarted();
+        qint64 paintStart = counters.now();
         QPainter p(this);
         p.fillRect(rect(), Qt::black);
+        glyphs.setDevicePixelRatio(devicePixelRatioF());
 
+        // Scrolled back, the top rows come from the history and the
+        // screen moves down; only the visible history lines are decoded.
+        const CellGrid &screen = emulator.cells();
+        int cursorX = emulator.cursorColumn(), cursorY = emulator.cursorRow();
+        int back = history.offset();
         for (int y = 0; y < rows; ++y) {
-            for (int x = 0; x < cols; ++x) {
-                const Cell &cell = screen[y][x];
-                if (cell.ch.isNull()) continue;
-                p.setPen(cell.color);
-                p.drawText(x * charWidth, (y + 1) * charHeight - baseline, cell.ch);
+            const PackedCell *line = y < back ? history.line(scrollback, history.lineAt(y), cols)
+                                              : screen.row(y - back);
+            int x = 0;
+            while (x < cols) {
+                int end = x + 1;
+                while (end < cols && line[end].sameRun(line[x])) ++end;
+                drawRun(p, line, x, end, y);
+                x = end;
             }
         }
 
-        if (cursorVisible) {
-            p.setPen(Qt::white);
-            p.fillRect(QRect(cursorX * charWidth, cursorY * charHeight, charWidth, charHeight), Qt::white);
-            if (cursorY < rows && cursorX < cols) {
-                p.setPen(Qt::black);
-                p.drawText(cursorX * charWidth, (cursorY + 1) * charHeight - baseline, screen[cursorY][cursorX].ch);
-            }
+        if (cursorVisible && cursorY + back < rows) {
+            p.fillRect(QRect(cursorX * charWidth, (cursorY + back) * charHeight, charWidth, charHeight), Qt::white);
+            if (cursorY < rows && cursorX < cols && !screen.at(cursorY, cursorX).isBlank())
+                drawGlyph(p, cursorX, cursorY + back, screen.at(cursorY, cursorX).ch, qRgb(0, 0, 0));
         }
+        counters.painted(paintStart, quint64(rows) * cols);
+        latency.paintFinished();
     }
 
 
     void keyPressEvent(QKeyEvent *event) override {
         QByteArray input;
 
+        if (latency.isEnabled() && event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)
+            && event->key() == Qt::Key_L) {
+            fputs(qPrintable(latency.report()), stderr);
+            return;
+        }
+
+        if (event->modifiers() & Qt::ShiftModifier
+            && (event->key() == Qt::Key_PageUp || event->key() == Qt::Key_PageDown)) {
+            scrollBar->triggerAction(event->key() == Qt::Key_PageUp ? QAbstractSlider::SliderPageStepSub
+                                                                    : QAbstractSlider::SliderPageStepAdd);
+            return;
+        }
+
         if (event->modifiers() & Qt::ControlModifier && event->key() >= Qt::Key_A && event->key() <= Qt::Key_Z) {
             input.append(char(event->key() - Qt::Key_A + 1));  // Ctrl+A → \x01
         } else {
@@ -92,8 +255,15 @@ protected:
             }
         }
 
-        if (!input.isEmpty() && masterFd >= 0)
-            write(masterFd, input.constData(), input.length());
+        if (!input.isEmpty()) {
+            latency.keyPressed();
+            scrollToBottom();
+            sendInput(input);
+        }
+    }
+
+    void wheelEvent(QWheelEvent *event) override {
+        scrollBar->setValue(scrollBar->value() - event->angleDelta().y() / 40);
     }
 
 
@@ -107,16 +277,16 @@ protected:
         seq.append(32 + 0); // left button
         seq.append(32 + x);
         seq.append(32 + y);
-        if (masterFd >= 0)
-            write(masterFd, seq.constData(), seq.length());
+        sendInput(seq);
     }
 
     void resizeEvent(QResizeEvent *) override {
-        cols = width() / charWidth;
-        rows = height() / charHeight;
-        screen.resize(rows);
-        for (auto &row : screen)
-            row.resize(cols);
+        int barWidth = scrollBar->sizeHint().width();
+        scrollBar->setGeometry(width() - barWidth, 0, barWidth, height());
+        cols = qMax(2, (width() - barWidth) / charWidth);
+        rows = qMax(2, height() / charHeight);
+        emulator.resize(rows, cols);
+        syncHistory();
 
         struct winsize ws = { (unsigned short)rows, (unsigned short)cols, 0, 0 };
         ioctl(masterFd, TIOCSWINSZ, &ws);
@@ -124,23 +294,29 @@ protected:
     }
 
 private:
-    struct Cell {
-        QChar ch;
-        QColor color;
-        Cell() : ch(' '), color(Qt::white) {}
-        Cell(QChar c, QColor col) : ch(c), color(col) {}
-    };
-
     int masterFd = -1;
     pid_t pid = -1;
-    QVector<QVector<Cell>> screen = QVector<QVector<Cell>>(TERM_ROWS, QVector<Cell>(TERM_COLS));
+    GridEmulator emulator{TERM_ROWS, TERM_COLS};
     int rows = TERM_ROWS;
     int cols = TERM_COLS;
-    int cursorX = 0, cursorY = 0;
     int charWidth = 10, charHeight = 18, baseline = 4;
-    QColor currentColor = Qt::white;
     bool cursorVisible = true;
     QTimer *cursorTimer;
+    QSocketNotifier *readNotifier = nullptr;
+    PtyReader *reader = nullptr;
+    PtyWriter *writer = nullptr;
+    FrameScheduler frameScheduler{this};
+    QByteArray readBuffer = QByteArray(READ_CHUNK, Qt::Uninitialized);
+    int budget = DEFAULT_READ_BUDGET;
+    int lastFrameBytes = 0;
+    GlyphAtlas glyphs;
+    Scrollback scrollback;
+    HistoryView history;
+    QScrollBar *scrollBar = nullptr;
+    LatencyProbe latency;
+    PerfCounters counters;
+    QString traceFile;
+    bool atlasEnabled = true;
 
     void initFont() {
         QFont f("Courier", 12);
@@ -150,7 +326,79 @@ private:
     //    charHeight = fm.height();
         baseline = fm.ascent();
         charHeight = fm.height() + 2; // slight padding
+        glyphs.setFont(f, charWidth, charHeight, baseline);
+    }
 
+    // Cells [x, end) of row y share their attributes: fill the background
+    // once, then blit the glyphs from the atlas or draw the whole run with
+    // a single drawText().
+    void drawRun(QPainter &p, const PackedCell *line, int x, int end, int y) {
+        const PackedCell &first = line[x];
+        QRgb fg = CellColor::resolve(first.fg, DEFAULT_FG);
+        QRgb bg = CellColor::resolve(first.bg, DEFAULT_BG);
+        if (first.attrs & PackedCell::Inverse)
+            qSwap(fg, bg);
+        if (bg != DEFAULT_BG)
+            p.fillRect(x * charWidth, y * charHeight, (end - x) * charWidth, charHeight, QColor::fromRgb(bg));
+        int style = first.attrs & PackedCell::StyleMask;
+
+        QString text;
+        text.reserve(end - x);
+        bool blank = true;
+        for (int i = x; i < end; ++i) {
+            uint ch = line[i].isBlank() ? ' ' : uint(line[i].ch);
+            if (ch != ' ') {
+                blank = false;
+                if (atlasEnabled) {
+                    glyphs.draw(p, i * charWidth, y * charHeight, ch, style, fg);
+                    continue;
+                }
+            }
+            if (!atlasEnabled)
+                text += QString::fromUcs4(&ch, 1);
+        }
+        if (blank || atlasEnabled) return;
+        QFont f = font();
+        f.setBold(style & PackedCell::Bold);
+        f.setItalic(style & PackedCell::Italic);
+        f.setUnderline(style & PackedCell::Underline);
+        p.setFont(f);
+        p.setPen(QColor::fromRgb(fg));
+        p.drawText(x * charWidth, (y + 1) * charHeight - baseline, text);
+    }
+
+    void drawGlyph(QPainter &p, int x, int y, uint ch, QRgb color) {
+        if (atlasEnabled) {
+            glyphs.draw(p, x * charWidth, y * charHeight, ch, 0, color);
+        } else {
+            p.setPen(QColor::fromRgb(color));
+            p.drawText(x * charWidth, (y + 1) * charHeight - baseline, QString::fromUcs4(&ch, 1));
+        }
+    }
+
+    void initScrollBar() {
+        scrollBar = new QScrollBar(Qt::Vertical, this);
+        scrollBar->setRange(0, 0);
+        connect(scrollBar, &QScrollBar::valueChanged, this, &TerminalWidget::scrollHistory);
+    }
+
+    // Bring the viewport and the scroll bar up to date with the history.
+    void syncHistory() {
+        history.setHistory(scrollback.droppedLines(), scrollback.lineCount());
+        QSignalBlocker block(scrollBar);
+        scrollBar->setRange(0, history.lineCount());
+        scrollBar->setPageStep(rows);
+        scrollBar->setValue(history.scrollValue());
+    }
+
+    // The rows still visible after a scroll are blitted; Qt repaints only
+    // the rows scrolled into view.
+    void scrollHistory(int value) {
+        int before = history.offset();
+        history.scrollTo(value);
+        int delta = history.offset() - before;
+        if (delta)
+            frameScheduler.requestScroll(QRect(0, 0, scrollBar->x(), rows * charHeight), 0, delta * charHeight);
     }
 
     void startPTY() {
@@ -166,10 +414,16 @@ private:
         fcntl(masterFd, F_SETFL, O_NONBLOCK);
     }
 
+    void startReadNotifier() {
+        if (masterFd < 0) return;
+        // Wake up only when the master fd is readable instead of polling it.
+        readNotifier = new QSocketNotifier(masterFd, QSocketNotifier::Read, this);
+        connect(readNotifier, &QSocketNotifier::activated, this, &TerminalWidget::readFromPty);
+        writer = new PtyWriter(masterFd);
+        writer->setWrittenCallback([this]() { latency.written(); });
+    }
+
     void startTimer() {
-        QTimer *timer = new QTimer(this);
-        connect(timer, &QTimer::timeout, this, &TerminalWidget::readFromPty);
-        timer->start(10);
         cursorTimer = new QTimer(this);
         connect(cursorTimer, &QTimer::timeout, this, [this]() {
             cursorVisible = !cursorVisible;
@@ -181,69 +435,80 @@ private:
 
     void readFromPty() {
         if (masterFd < 0) return;
-        char buf[4096];
-        int n = read(masterFd, buf, sizeof(buf));
-        if (n > 0)
-            handleOutput(QByteArray::fromRawData(buf, n));
-    }
-
-    void handleOutput(const QByteArray &data) {
-        static QByteArray escBuf;
-        int i = 0;
-        while (i < data.size()) {
-            uchar byte = data[i];
-            if (!escBuf.isEmpty() || byte == '\x1B') {
-                escBuf.append(byte);
-                if (byte >= '@' && byte <= '~') {
-                    parseEscapeSequence(escBuf);
-                    escBuf.clear();
-                }
-                ++i;
+        char *buf = readBuffer.data();
+        int total = 0;
+        while (total < budget) {
+            ssize_t n = read(masterFd, buf, qMin(readBuffer.size(), budget - total));
+            if (n > 0) {
+                latency.outputRead();
+                counters.read(n);
+                total += n;
+                handleOutput(QByteArray::fromRawData(buf, n));
                 continue;
             }
-
-            if (byte == '\n') {
-                cursorX = 0;
-                cursorY = qMin(cursorY + 1, rows - 1);
-            } else {
-                if (cursorY < rows && cursorX < cols)
-                    screen[cursorY][cursorX] = Cell(QChar(byte), currentColor);
-                cursorX++;
-                if (cursorX >= cols) {
-                    cursorX = 0;
-                    cursorY = qMin(cursorY + 1, rows - 1);
-                }
-            }
-            ++i;
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0 || errno != EAGAIN)
+                readNotifier->setEnabled(false); // child exited, stop the notifier from spinning
+            break;
         }
-        update();
-    }
-
-    void parseEscapeSequence(const QByteArray &seq) {
-        if (seq.startsWith("\x1B[")) {
-            QRegularExpression regex("\\x1B\\[(\d+)(;(\d+))*m");
-            QRegularExpressionMatch match = regex.match(seq);
-            if (match.hasMatch()) {
-                int code = match.captured(1).toInt();
-                switch (code) {
-                    case 30: currentColor = Qt::black; break;
-                    case 31: currentColor = Qt::red; break;
-                    case 32: currentColor = Qt::green; break;
-                    case 33: currentColor = Qt::yellow; break;
-                    case 34: currentColor = Qt::blue; break;
-                    case 35: currentColor = Qt::magenta; break;
-                    case 36: currentColor = Qt::cyan; break;
-                    case 37: currentColor = Qt::white; break;
-                    default: break;
-                }
-            }
+        lastFrameBytes = total;
+        if (total > 0)
+            emit outputConsumed(total);
+    }
+
+    void drainReader() {
+        if (!reader) return;
+        SpscByteRing &ring = reader->ring();
+        int total = 0;
+        while (total < budget) {
+            size_t len;
+            const char *data = ring.readSpan(&len);
+            if (!len) break;
+            len = qMin(len, size_t(budget - total));
+            handleOutput(QByteArray::fromRawData(data, int(len)));
+            ring.commitRead(len);
+            total += int(len);
         }
+        lastFrameBytes = total;
+        reader->acknowledge(); // re-arms the reader; it calls back again if data is left
+        if (total > 0)
+            emit outputConsumed(total);
+    }
+
+    void handleOutput(const QByteArray &data) {
+        qint64 start = counters.now();
+        quint64 scrolled = emulator.scrolledLines();
+        counters.parsed(data.constData(), size_t(data.size()));
+        emulator.write(data.constData(), data.size());
+        counters.add(PerfCounters::LinesScrolled, emulator.scrolledLines() - scrolled);
+        counters.span("parse", start, counters.now(), data.size());
+        latency.parsed();
+        syncHistory();
+        frameScheduler.requestFrame();
     }
 };
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
     TerminalWidget term;
+    if (qEnvironmentVariableIsSet("QTERM_THREADED_READS"))
+        term.setThreadedReads(true);
+    if (qEnvironmentVariableIsSet("QTERM_LATENCY_PROBE"))
+        term.setLatencyProbeEnabled(true);
+    if (qEnvironmentVariableIsSet("QTERM_PERF_COUNTERS"))
+        term.perfCounters().setEnabled(true);
+    if (qEnvironmentVariableIsSet("QTERM_TRACE"))
+        term.setTraceFile(qEnvironmentVariable("QTERM_TRACE"));
+    if (qEnvironmentVariableIsSet("QTERM_SCROLLBACK_FILE")) {
+        QString path = qEnvironmentVariable("QTERM_SCROLLBACK_FILE");
+        term.setScrollbackFile(path.isEmpty() ? Scrollback::defaultSpillPath() : path, !path.isEmpty());
+    }
+    if (app.arguments().contains("--render-benchmark")) {
+        QByteArray json = term.renderBenchmark();
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+        return 0;
+    }
     term.setWindowTitle("Qt Terminal Grid");
     term.resize(TERM_COLS * 10, TERM_ROWS * 18);
     term.show();
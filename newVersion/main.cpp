@@ -5,8 +5,14 @@
 #include <QWidget>
 #include <QPainter>
 #include <QTimer>
+#include <QSocketNotifier>
 #include <QKeyEvent>
+#include <QWheelEvent>
+#include <QScrollBar>
 #include <QFontMetrics>
+#include <QPaintEvent>
+#include <QRegion>
+#include <QMutex>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -24,29 +30,31 @@
 #include <sys/ioctl.h>
 #include <signal.h>
 #include <string.h>
+#include <errno.h>
 #include <vterm.h>
 
+#include <atomic>
+
+#include "cellgrid.h"
+#include "framescheduler.h"
+#include "glyphatlas.h"
+#include "historyview.h"
+#include "latencyprobe.h"
+#include "perfcounters.h"
+#include "renderbench.h"
+#include "ptyreader.h"
+#include "ptywriter.h"
+#include "scrollback.h"
+#include "parserworker.h"
+#include "triplebuffer.h"
+
 constexpr int TERM_ROWS = 24;
 constexpr int TERM_COLS = 80;
+constexpr int READ_CHUNK = 64 * 1024;
+constexpr int DEFAULT_READ_BUDGET = 256 * 1024;
 
-struct Cell {
-    QChar ch;
-    QColor fg;
-    QColor bg;
-    bool bold;
-    bool underline;
-    bool inverse;
-
-    Cell() : ch(' '), fg(Qt::white), bg(Qt::black),
-             bold(false), underline(false), inverse(false) {}
-};
-
-typedef struct {
-    VTermColor fg;  // foreground color
-    VTermColor bg;  // background color
-
-} VTermScreenCellAttrs;
-
+constexpr QRgb DEFAULT_FG = 0xffffffff;
+constexpr QRgb DEFAULT_BG = 0xff000000;
 
 class TerminalWidget : public QWidget {
     Q_OBJECT
@@ -58,6 +66,13 @@ public:
           screen(nullptr),
           masterFd(-1),
           pid(-1),
+          readNotifier(nullptr),
+          reader(nullptr),
+          writer(nullptr),
+          worker(nullptr),
+          readBuffer(READ_CHUNK, Qt::Uninitialized),
+          budget(DEFAULT_READ_BUDGET),
+          lastFrameBytes(0),
           cursorVisible(true),
           blinkState(false),
           charWidth(10),
@@ -66,18 +81,32 @@ public:
     {
         setFocusPolicy(Qt::StrongFocus);
         setMouseTracking(true);
+        setAttribute(Qt::WA_OpaquePaintEvent); // every repainted cell is filled
         initFont();
+        initScrollBar();
+        frameScheduler.setCounters(&counters);
         initVTerm();
         startPTY();
         startTimers();
 
         // Initialize screen buffer with blank cells
-        screenBuffer.resize(TERM_ROWS);
-        for (auto &row : screenBuffer)
-            row.resize(TERM_COLS);
+        screenBuffer.resize(TERM_ROWS, TERM_COLS);
     }
 
     ~TerminalWidget() override {
+        if (latency.isEnabled())
+            fputs(qPrintable(latency.report()), stderr);
+        if (counters.isEnabled())
+            fputs(qPrintable(counters.report()), stderr);
+        if (!traceFile.isEmpty())
+            counters.writeTrace(traceFile);
+        if (reader)
+            reader->stop();
+        delete worker;
+        delete reader;
+        delete writer;
+        if (readNotifier)
+            readNotifier->setEnabled(false);
         if (pid > 0)
             kill(pid, SIGKILL);
         if (masterFd >= 0)
@@ -87,51 +116,254 @@ public:
         }
     }
 
-protected:
-    void paintEvent(QPaintEvent *) override {
-        QPainter p(this);
-        p.fillRect(rect(), Qt::black);
+    // Maximum number of PTY bytes fed to libvterm per wakeup. Anything left
+    // in the PTY is picked up on the next event loop iteration, which keeps
+    // input and painting responsive under a flood of output.
+    void setReadBudget(int bytes) { budget = qMax(bytes, 1); }
+    int readBudget() const { return budget; }
+    int bytesReadLastFrame() const { return lastFrameBytes; }
+
+    // Optional mode where a background thread owns the PTY reads and queues
+    // output in a lock-free ring. The GUI thread is only woken once enough
+    // output has piled up or a frame interval has passed.
+    void setThreadedReads(bool on) {
+        if (masterFd < 0 || worker || on == (reader != nullptr))
+            return;
+        if (on) {
+            readNotifier->setEnabled(false);
+            reader = new PtyReader(masterFd);
+            reader->setCounters(&counters);
+            reader->setDataCallback([this]() {
+                latency.outputRead();
+                QMetaObject::invokeMethod(this, [this]() { onReaderData(); }, Qt::QueuedConnection);
+            });
+            reader->start();
+        } else {
+            reader->stop();
+            while (!reader->ring().isEmpty())
+                onReaderData();
+            delete reader;
+            reader = nullptr;
+            readNotifier->setEnabled(true);
+        }
+    }
 
-        for (int y = 0; y < TERM_ROWS; ++y) {
-            for (int x = 0; x < TERM_COLS; ++x) {
-                const Cell &c = screenBuffer[y][x];
+    bool threadedReads() const { return reader != nullptr; }
 
-                QColor fg = c.fg;
-                QColor bg = c.bg;
+    // Move vterm_input_write() off the GUI thread as well. The worker owns
+    // the VTerm and the cell buffer; at frame boundaries it publishes a
+    // snapshot into a triple buffer which paintEvent reads without locks.
+    void setThreadedParsing(bool on) {
+        if (masterFd < 0 || on == (worker != nullptr))
+            return;
+        if (on) {
+            setThreadedReads(false);
+            readNotifier->setEnabled(false);
+            reader = new PtyReader(masterFd);
+            worker = new ParserWorker(reader);
+            reader->setCounters(&counters);
+            reader->setDataCallback([this]() {
+                latency.outputRead();
+                worker->wake();
+            });
+            worker->setParseFunction([this](const char *data, size_t len) {
+                qint64 start = counters.now();
+                counters.parsed(data, len);
+                vterm_input_write(vterm, data, len);
+                counters.span("parse", start, counters.now(), qint64(len));
+            });
+            worker->setPublishFunction([this]() { publishFrame(); });
+            worker->setFrameCallback([this]() {
+                if (!framePosted.exchange(true))
+                    QMetaObject::invokeMethod(this, [this]() { presentFrame(); }, Qt::QueuedConnection);
+            });
+            publishFrame();
+            frames.acquire();
+            publishedDamage = QRegion();
+            worker->start();
+            reader->start();
+        } else {
+            reader->stop();
+            delete worker;
+            worker = nullptr;
+            // The VTerm belongs to the GUI thread again.
+            while (!reader->ring().isEmpty())
+                onReaderData();
+            delete reader;
+            reader = nullptr;
+            readNotifier->setEnabled(true);
+            frameScheduler.requestFrame();
+        }
+    }
 
-                if (c.inverse) std::swap(fg, bg);
+    bool threadedParsing() const { return worker != nullptr; }
+
+    // Output repaints are coalesced to at most one frame per interval:
+    // maxFramesPerSecond, or the display refresh rate when 0. In low-latency
+    // mode the first frame after an idle period is painted immediately.
+    void setMaxFramesPerSecond(int fps) { frameScheduler.setMaxFramesPerSecond(fps); }
+    int maxFramesPerSecond() const { return frameScheduler.maxFramesPerSecond(); }
+    void setLowLatencyFirstFrame(bool on) { frameScheduler.setLowLatencyFirstFrame(on); }
+    bool lowLatencyFirstFrame() const { return frameScheduler.lowLatencyFirstFrame(); }
+
+    // Cells are blitted from a cache of pre-rendered glyphs; disabling it
+    // falls back to one drawText() per run of same-attribute cells.
+    void setGlyphAtlasEnabled(bool on) { atlasEnabled = on; update(); }
+    bool glyphAtlasEnabled() const { return atlasEnabled; }
+
+    // Lines scrolled off the top are kept in a compressed history capped
+    // at this many bytes; the oldest lines are dropped first.
+    void setScrollbackLimit(qint64 bytes) {
+        QMutexLocker lock(&scrollbackLock);
+        scrollback.setMaxBytes(bytes);
+    }
+    qint64 scrollbackLimit() const {
+        QMutexLocker lock(&scrollbackLock);
+        return scrollback.maxBytes();
+    }
+    int scrollbackLines() const {
+        QMutexLocker lock(&scrollbackLock);
+        return scrollback.lineCount();
+    }
 
-                // Paint background rect
-                p.fillRect(x * charWidth, y * charHeight, charWidth, charHeight, bg);
+    // Lines past the limit spill to a memory-mapped file instead of being
+    // dropped. With keep set, a file that already holds history is reopened
+    // and remapped, and the file is left on disk when the widget goes away;
+    // without it the file is created afresh and must not exist yet.
+    bool setScrollbackFile(const QString &path, bool keep = false) {
+        bool ok;
+        {
+            QMutexLocker lock(&scrollbackLock);
+            ok = scrollback.setSpillFile(path, keep ? Scrollback::KeepOnClose : Scrollback::RemoveOnClose);
+        }
+        history.reset();
+        syncHistory();
+        return ok;
+    }
+    QString scrollbackFile() const {
+        QMutexLocker lock(&scrollbackLock);
+        return scrollback.spillFile();
+    }
 
-                // Paint text
-                p.setPen(fg);
-                QFont font = this->font();
-                font.setBold(c.bold);
-                font.setUnderline(c.underline);
-                p.setFont(font);
+    // Queues bytes for the child as if typed; see ptywriter.h. Pastes of
+    // any size are fine: they are written as fast as the child reads.
+    void sendInput(const QByteArray &bytes) {
+        if (writer)
+            writer->write(bytes);
+    }
 
-                if (!c.ch.isNull() && c.ch != QChar(' '))
-                    p.drawText(x * charWidth, (y + 1) * charHeight - baseline, c.ch);
+    // Keystroke-to-paint latency per stage (see latencyprobe.h). While it
+    // is enabled, Ctrl+Shift+L prints the histograms to stderr, and so
+    // does closing the widget.
+    void setLatencyProbeEnabled(bool on) { latency.setEnabled(on); }
+    bool latencyProbeEnabled() const { return latency.isEnabled(); }
+    QString latencyReport() const { return latency.report(); }
+
+    // Pipeline counters and the per-frame trace (see perfcounters.h), both
+    // off until enabled here. Closing the widget prints the counters to
+    // stderr and writes the trace to the trace file, if one is set.
+    PerfCounters &perfCounters() { return counters; }
+    const PerfCounters &perfCounters() const { return counters; }
+    void setTraceFile(const QString &path) {
+        traceFile = path;
+        counters.setTracing(!path.isEmpty());
+    }
+
+    // History lines shown above the screen; 0 follows the live output.
+    int scrollOffset() const { return history.offset(); }
+    void scrollToBottom() { scrollBar->setValue(scrollBar->maximum()); }
+
+    // paintEvent timings on fixed screens, as JSON (see renderbench.h).
+    // Overwrites the cell buffer; run it without threaded parsing.
+    QByteArray renderBenchmark(int frames = RenderBench::DefaultFrames) {
+        RenderBench bench(this, "libvterm", [this](const RenderFixture &f) {
+            resize(f.cols * charWidth + scrollBar->sizeHint().width(), f.rows * charHeight);
+            screenBuffer.resize(f.rows, f.cols);
+            for (int y = 0; y < f.rows; ++y)
+                for (int x = 0; x < f.cols; ++x)
+                    screenBuffer.at(y, x) = f.cell(y, x);
+        }, [this](bool on) { setGlyphAtlasEnabled(on); });
+        return bench.run(frames);
+    }
+
+signals:
+    void outputConsumed(int bytes);
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        latency.paintStarted();
+        qint64 paintStart = counters.now();
+        QPainter p(this);
+        const QRegion &region = event->region();
+        p.fillRect(event->rect(), Qt::black);
+        glyphs.setDevicePixelRatio(devicePixelRatioF());
+
+        // With threaded parsing screenBuffer belongs to the worker; paint
+        // the latest snapshot it published instead.
+        const Frame *f = worker ? &frames.front() : nullptr;
+        const CellGrid &cells = f ? f->cells : screenBuffer;
+        int cursorX = f ? f->cursorX : this->cursorX;
+        int cursorY = f ? f->cursorY : this->cursorY;
+        bool cursorVisible = f ? f->cursorVisible : this->cursorVisible;
+
+        // Scrolled back, the top rows come from the history and the screen
+        // moves down; only the visible history lines are decoded.
+        int back = history.offset();
+        quint64 cellsPainted = 0;
+        for (int y = 0; y < cells.rows(); ++y) {
+            // Only the columns of this row that are inside the update region.
+            QRect span = region.intersected(QRect(0, y * charHeight, width(), charHeight)).boundingRect();
+            if (span.isEmpty())
+                continue;
+            const PackedCell *line;
+            if (y < back) {
+                QMutexLocker lock(&scrollbackLock);
+                line = history.line(scrollback, history.lineAt(y), cells.columns());
+            } else {
+                line = cells.row(y - back);
+            }
+            int x1 = qMin(cells.columns(), span.right() / charWidth + 1);
+            int x = span.left() / charWidth;
+            cellsPainted += qMax(x1 - x, 0);
+            while (x < x1) {
+                int end = x + 1;
+                while (end < x1 && line[end].sameRun(line[x]))
+                    ++end;
+                drawRun(p, line, x, end, y);
+                x = end;
             }
         }
 
         // Draw blinking cursor
-        if (cursorVisible && blinkState) {
-            p.fillRect(cursorX * charWidth, cursorY * charHeight, charWidth, charHeight, Qt::white);
-
-            if (cursorY < TERM_ROWS && cursorX < TERM_COLS) {
-                p.setPen(Qt::black);
-                QChar c = screenBuffer[cursorY][cursorX].ch;
-                if (!c.isNull() && c != QChar(' '))
-                    p.drawText(cursorX * charWidth, (cursorY + 1) * charHeight - baseline, c);
+        if (cursorVisible && blinkState && cursorY + back < cells.rows()) {
+            p.fillRect(cursorX * charWidth, (cursorY + back) * charHeight, charWidth, charHeight, Qt::white);
+
+            if (cursorY < cells.rows() && cursorX < cells.columns()) {
+                const PackedCell &c = cells.at(cursorY, cursorX);
+                if (!c.isBlank())
+                    drawGlyph(p, cursorX, cursorY + back, c, DEFAULT_BG);
             }
         }
+        counters.painted(paintStart, cellsPainted);
+        latency.paintFinished();
     }
 
     void keyPressEvent(QKeyEvent *event) override {
         QByteArray input;
 
+        if (latency.isEnabled() && event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)
+            && event->key() == Qt::Key_L) {
+            fputs(qPrintable(latency.report()), stderr);
+            return;
+        }
+
+        if (event->modifiers() & Qt::ShiftModifier
+            && (event->key() == Qt::Key_PageUp || event->key() == Qt::Key_PageDown)) {
+            scrollBar->triggerAction(event->key() == Qt::Key_PageUp ? QAbstractSlider::SliderPageStepSub
+                                                                    : QAbstractSlider::SliderPageStepAdd);
+            return;
+        }
+
         // Map special keys to VT sequences
         switch (event->key()) {
         case Qt::Key_Backspace:
@@ -177,14 +409,24 @@ protected:
             break;
         }
 
-        if (!input.isEmpty() && masterFd >= 0) {
-            ::write(masterFd, input.constData(), input.size());
+        if (!input.isEmpty()) {
+            latency.keyPressed();
+            scrollToBottom();
+            sendInput(input);
         }
     }
 
+    void wheelEvent(QWheelEvent *event) override {
+        scrollBar->setValue(scrollBar->value() - event->angleDelta().y() / 40);
+    }
+
     void resizeEvent(QResizeEvent *) override {
-        int newCols = width() / charWidth;
-        int newRows = height() / charHeight;
+        int barWidth = scrollBar->sizeHint().width();
+        scrollBar->setGeometry(width() - barWidth, 0, barWidth, height());
+        scrollBar->setPageStep(screenBuffer.rows());
+
+        int newCols = qMax(2, (width() - barWidth) / charWidth);
+        int newRows = qMax(2, height() / charHeight);
 
         if (newCols != TERM_COLS || newRows != TERM_ROWS) {
             // We do not resize libvterm dynamically here, but you could recreate vterm.
@@ -198,25 +440,119 @@ private slots:
         if (masterFd < 0)
             return;
 
-        char buf[4096];
-        ssize_t n = read(masterFd, buf, sizeof(buf));
-        if (n > 0) {
-            vterm_input_write(vterm, buf, n);
-            updateScreenFromVTerm();
-            update();
+        char *buf = readBuffer.data();
+        int total = 0;
+        qint64 start = counters.now();
+        while (total < budget) {
+            ssize_t n = read(masterFd, buf, qMin(readBuffer.size(), budget - total));
+            if (n > 0) {
+                latency.outputRead();
+                counters.read(n);
+                counters.parsed(buf, size_t(n));
+                vterm_input_write(vterm, buf, n);
+                total += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0 || errno != EAGAIN) {
+                // Child exited: a level-triggered notifier would fire forever.
+                readNotifier->setEnabled(false);
+            }
+            break;
+        }
+
+        lastFrameBytes = total;
+        if (total > 0) {
+            // Copy the damaged cells once per wakeup, not once per read().
+            refreshDamaged();
+            counters.span("parse", start, counters.now(), total);
+            emit outputConsumed(total);
         }
     }
 
+    void onReaderData() {
+        if (!reader)
+            return;
+
+        SpscByteRing &ring = reader->ring();
+        int total = 0;
+        qint64 start = counters.now();
+        while (total < budget) {
+            size_t len;
+            const char *data = ring.readSpan(&len);
+            if (!len)
+                break;
+            len = qMin(len, size_t(budget - total));
+            counters.parsed(data, len);
+            vterm_input_write(vterm, data, len);
+            ring.commitRead(len);
+            total += int(len);
+        }
+        reader->acknowledge();
+
+        lastFrameBytes = total;
+        if (total > 0) {
+            refreshDamaged();
+            counters.span("parse", start, counters.now(), total);
+            emit outputConsumed(total);
+        }
+    }
+
+    // GUI thread: pick up the newest snapshot published by the worker.
+    void presentFrame() {
+        framePosted = false;
+        if (!worker)
+            return;
+        QRegion damage;
+        {
+            QMutexLocker lock(&damageLock);
+            if (!frames.acquire())
+                return;
+            damage.swap(publishedDamage);
+        }
+        latency.parsed();   // the frame is now on the GUI thread
+        syncHistory();
+        frameScheduler.requestFrame(cellsToPixels(damage));
+    }
+
     void onCursorBlink() {
         blinkState = !blinkState;
-        update();
+        const Frame *f = worker ? &frames.front() : nullptr;
+        int x = f ? f->cursorX : cursorX;
+        int y = (f ? f->cursorY : cursorY) + history.offset();
+        update(x * charWidth, y * charHeight, charWidth, charHeight);
     }
 
 private:
+    // Snapshot of the cell buffer handed from the parser worker to
+    // paintEvent. Copying the implicitly shared grid is O(1); the worker's
+    // next write detaches it once, as a whole.
+    struct Frame {
+        CellGrid cells;
+        int cursorX = 0, cursorY = 0;
+        bool cursorVisible = true;
+        qint64 historyFirst = 0;    // the history as of this screen
+        int historyLines = 0;
+    };
+
     VTerm *vterm;
     VTermScreen *screen;
     int masterFd;
     pid_t pid;
+    QSocketNotifier *readNotifier;
+    PtyReader *reader;
+    PtyWriter *writer;
+    ParserWorker *worker;
+    TripleBuffer<Frame> frames;
+    FrameScheduler frameScheduler{this};
+    std::atomic<bool> framePosted{false};
+    QRegion cellDamage;         // in cells, owned by whichever thread owns vterm
+    QMutex damageLock;          // guards publishedDamage and frames.publish()
+    QRegion publishedDamage;    // in cells, damage of the published frames
+    QByteArray readBuffer;
+    int budget;
+    int lastFrameBytes;
 
     int cursorX = 0, cursorY = 0;
     bool cursorVisible;
@@ -224,7 +560,17 @@ private:
 
     int charWidth, charHeight, baseline;
 
-    QVector<QVector<Cell>> screenBuffer;
+    CellGrid screenBuffer;
+    GlyphAtlas glyphs;
+    mutable QMutex scrollbackLock;  // the parsing thread pushes, the GUI reads
+    Scrollback scrollback;
+    QVector<PackedCell> pushedLine;
+    HistoryView history;        // GUI thread only
+    QScrollBar *scrollBar = nullptr;
+    LatencyProbe latency;
+    PerfCounters counters;
+    QString traceFile;
+    bool atlasEnabled = true;
 
     void initFont() {
         QFont f("Courier New", 12);
@@ -233,25 +579,162 @@ private:
         charWidth = fm.horizontalAdvance('M');
         charHeight = fm.height();
         baseline = fm.descent();
+        glyphs.setFont(f, charWidth, charHeight, baseline);
+    }
+
+    void initScrollBar() {
+        scrollBar = new QScrollBar(Qt::Vertical, this);
+        scrollBar->setRange(0, 0);
+        connect(scrollBar, &QScrollBar::valueChanged, this, &TerminalWidget::scrollHistory);
+    }
+
+    // GUI thread: bring the viewport and the scroll bar up to date with the
+    // history behind the screen about to be painted.
+    void syncHistory() {
+        qint64 first;
+        int count;
+        if (worker) {
+            first = frames.front().historyFirst;
+            count = frames.front().historyLines;
+        } else {
+            QMutexLocker lock(&scrollbackLock);
+            first = scrollback.droppedLines();
+            count = scrollback.lineCount();
+        }
+        // New lines push a scrolled-back screen further down.
+        if (history.setHistory(first, count))
+            frameScheduler.requestFrame();
+        QSignalBlocker block(scrollBar);
+        scrollBar->setRange(0, history.lineCount());
+        scrollBar->setValue(history.scrollValue());
+    }
+
+    // The rows still visible after a scroll are blitted; Qt repaints only
+    // the rows scrolled into view.
+    void scrollHistory(int value) {
+        int before = history.offset();
+        history.scrollTo(value);
+        int delta = history.offset() - before;
+        if (delta)
+            frameScheduler.requestScroll(QRect(0, 0, scrollBar->x(), screenBuffer.rows() * charHeight),
+                                         0, delta * charHeight);
     }
 
+    // Cells [x, end) of row y share colours and style: one fillRect for the
+    // background and, without the atlas, one drawText for the text.
+    void drawRun(QPainter &p, const PackedCell *line, int x, int end, int y) {
+        const PackedCell &first = line[x];
+        QRgb fg = CellColor::resolve(first.fg, DEFAULT_FG);
+        QRgb bg = CellColor::resolve(first.bg, DEFAULT_BG);
+        if (first.attrs & PackedCell::Inverse)
+            qSwap(fg, bg);
+        if (bg != DEFAULT_BG)
+            p.fillRect(x * charWidth, y * charHeight, (end - x) * charWidth, charHeight, QColor::fromRgb(bg));
+        bool underline = first.attrs & PackedCell::Underline;
+
+        if (atlasEnabled) {
+            for (int i = x; i < end; ++i) {
+                const PackedCell &c = line[i];
+                if (c.ch && (c.ch != ' ' || underline))
+                    drawGlyph(p, i, y, c, fg);
+            }
+            return;
+        }
+
+        QString text;
+        text.reserve(end - x);
+        bool blank = !underline;
+        for (int i = x; i < end; ++i) {
+            uint ch = line[i].isBlank() ? ' ' : uint(line[i].ch);
+            if (ch != ' ')
+                blank = false;
+            text += QString::fromUcs4(&ch, 1);
+        }
+        if (blank)
+            return;
+        QFont font = this->font();
+        font.setBold(first.attrs & PackedCell::Bold);
+        font.setItalic(first.attrs & PackedCell::Italic);
+        font.setUnderline(underline);
+        p.setFont(font);
+        p.setPen(QColor::fromRgb(fg));
+        p.drawText(x * charWidth, (y + 1) * charHeight - baseline, text);
+    }
+
+    void drawGlyph(QPainter &p, int x, int y, const PackedCell &c, QRgb color) {
+        int style = c.attrs & PackedCell::StyleMask;
+        uint ch = c.ch;
+        if (atlasEnabled) {
+            glyphs.draw(p, x * charWidth, y * charHeight, ch, style, color);
+            return;
+        }
+        QFont font = this->font();
+        font.setBold(style & PackedCell::Bold);
+        font.setItalic(style & PackedCell::Italic);
+        font.setUnderline(style & PackedCell::Underline);
+        p.setFont(font);
+        p.setPen(QColor::fromRgb(color));
+        p.drawText(x * charWidth, (y + 1) * charHeight - baseline, QString::fromUcs4(&ch, 1));
+    }
+
+    // Damage is accumulated per frame; only these cells are re-read from
+    // libvterm and only their pixels are invalidated.
     static int vtermScreenDamage(VTermRect rect, void *user) {
-        // Can be used to mark region dirty, but we'll just update whole widget
-        Q_UNUSED(rect);
         TerminalWidget *term = static_cast<TerminalWidget*>(user);
-        term->update();
-        return 0;
+        term->cellDamage += QRect(rect.start_col, rect.start_row,
+                                  rect.end_col - rect.start_col, rect.end_row - rect.start_row);
+        return 1;
+    }
+
+    static int vtermMoveCursor(VTermPos pos, VTermPos oldpos, int visible, void *user) {
+        TerminalWidget *term = static_cast<TerminalWidget*>(user);
+        term->cellDamage += QRect(oldpos.col, oldpos.row, 1, 1);
+        term->cellDamage += QRect(pos.col, pos.row, 1, 1);
+        term->cursorX = pos.col;
+        term->cursorY = pos.row;
+        term->cursorVisible = visible != 0;
+        return 1;
+    }
+
+    // libvterm moved already drawn cells (a scroll). Shift the cell cache to
+    // match and blit the pixels rather than re-reading and repainting them.
+    static int vtermMoveRect(VTermRect dest, VTermRect src, void *user) {
+        TerminalWidget *term = static_cast<TerminalWidget*>(user);
+        term->moveCells(QRect(src.start_col, src.start_row,
+                              src.end_col - src.start_col, src.end_row - src.start_row),
+                        QPoint(dest.start_col - src.start_col, dest.start_row - src.start_row));
+        return 1;
+    }
+
+    // A line scrolled off the top of the screen goes to the scrollback.
+    static int vtermPushLine(int cols, const VTermScreenCell *cells, void *user) {
+        TerminalWidget *term = static_cast<TerminalWidget*>(user);
+        term->pushedLine.resize(cols);
+        for (int i = 0; i < cols; ++i)
+            term->fillCell(term->pushedLine[i], cells[i]);
+        QMutexLocker lock(&term->scrollbackLock);
+        term->scrollback.push(term->pushedLine.constData(), cols);
+        return 1;
     }
 
     void initVTerm() {
         vterm = vterm_new(TERM_ROWS, TERM_COLS);
         vterm_set_utf8(vterm, 1);
         screen = vterm_obtain_screen(vterm);
-        vterm_screen_reset(screen, 1);
 
-        VTermScreenCallbacks cb {};
-        cb.damage = &TerminalWidget::vtermScreenDamage;
+        // libvterm keeps the pointer, so the table must outlive the screen.
+        static VTermScreenCallbacks cb = [] {
+            VTermScreenCallbacks c {};
+            c.damage = &TerminalWidget::vtermScreenDamage;
+            c.movecursor = &TerminalWidget::vtermMoveCursor;
+            c.moverect = &TerminalWidget::vtermMoveRect;
+            c.sb_pushline = &TerminalWidget::vtermPushLine;
+            return c;
+        }();
         vterm_screen_set_callbacks(screen, &cb, this);
+        // Merge damage until vterm_screen_flush_damage() once per batch.
+        vterm_screen_set_damage_merge(screen, VTERM_DAMAGE_SCROLL);
+        vterm_screen_reset(screen, 1);
     }
 
     void startPTY() {
@@ -268,66 +751,143 @@ private:
     }
 
     void startTimers() {
-        QTimer *readTimer = new QTimer(this);
-        connect(readTimer, &QTimer::timeout, this, &TerminalWidget::onReadPTY);
-        readTimer->start(10);
+        if (masterFd >= 0) {
+            readNotifier = new QSocketNotifier(masterFd, QSocketNotifier::Read, this);
+            connect(readNotifier, &QSocketNotifier::activated, this, &TerminalWidget::onReadPTY);
+            writer = new PtyWriter(masterFd);
+            writer->setWrittenCallback([this]() { latency.written(); });
+        }
 
         QTimer *blinkTimer = new QTimer(this);
         connect(blinkTimer, &QTimer::timeout, this, &TerminalWidget::onCursorBlink);
         blinkTimer->start(500);
     }
 
+    // Re-read the cells damaged since the last call. cellDamage is left
+    // in place for the caller to invalidate.
     void updateScreenFromVTerm() {
-        for (int row = 0; row < TERM_ROWS; ++row) {
-            for (int col = 0; col < TERM_COLS; ++col) {
-                VTermScreenCell cell;
-                VTermPos pos = { row, col };
-                vterm_screen_get_cell(screen, pos, &cell);
+        vterm_screen_flush_damage(screen);
+        for (const QRect &r : cellDamage) {
+            for (int row = r.top(); row <= r.bottom() && row < screenBuffer.rows(); ++row) {
+                PackedCell *line = screenBuffer.row(row);
+                for (int col = r.left(); col <= r.right() && col < screenBuffer.columns(); ++col) {
+                    VTermScreenCell cell;
+                    VTermPos pos = { row, col };
+                    vterm_screen_get_cell(screen, pos, &cell);
+                    fillCell(line[col], cell);
+                }
+            }
+        }
+    }
 
+    void moveCells(const QRect &src, const QPoint &delta) {
+        if (delta.x() == 0)
+            counters.add(PerfCounters::LinesScrolled, quint64(qAbs(delta.y())));
+        QRect dest = src.translated(delta);
+        // Copy in the direction that never overwrites unread source cells.
+        int rowStep = delta.y() > 0 ? -1 : 1;
+        int colStep = delta.x() > 0 ? -1 : 1;
+        bool wholeRows = src.left() == 0 && src.width() >= screenBuffer.columns() && delta.x() == 0;
+        bool wholeScreen = wholeRows && src.united(dest).top() <= 0
+                        && src.united(dest).bottom() >= screenBuffer.rows() - 1;
+        if (wholeScreen)
+            screenBuffer.scroll(-delta.y());    // O(1); libvterm damages the new rows
+        for (int i = 0; i < dest.height() && !wholeScreen; ++i) {
+            int row = rowStep > 0 ? dest.top() + i : dest.bottom() - i;
+            int from = row - delta.y();
+            if (row < 0 || row >= screenBuffer.rows() || from < 0 || from >= screenBuffer.rows())
+                continue;
+            if (wholeRows) {
+                screenBuffer.copyRow(row, from);
+                continue;
+            }
+            PackedCell *line = screenBuffer.row(row);
+            const PackedCell *source = screenBuffer.row(from);
+            int width = screenBuffer.columns();
+            for (int j = 0; j < dest.width(); ++j) {
+                int col = colStep > 0 ? dest.left() + j : dest.right() - j;
+                int fromCol = col - delta.x();
+                if (col >= 0 && col < width && fromCol >= 0 && fromCol < width)
+                    line[col] = source[fromCol];
+            }
+        }
 
+        // Damage not yet read back moves with the cells, so it is re-read at
+        // their new position.
+        QRect area = src.united(dest);
+        cellDamage = (cellDamage - area) + ((cellDamage & area).translated(delta) & area);
+        if (worker || !history.isLive()) {
+            // Skipped frames leave nothing on screen to blit from, and a
+            // scrolled-back screen is not where libvterm moved it.
+            cellDamage += dest;
+            return;
+        }
+        // The blit carries the drawn cursor along.
+        cellDamage += QRect(cursorX, cursorY, 1, 1).translated(delta) & area;
+        frameScheduler.requestScroll(cellsToPixels(area).boundingRect(),
+                                     delta.x() * charWidth, delta.y() * charHeight);
+    }
 
-                Cell &c = screenBuffer[row][col];
+    void fillCell(PackedCell &c, const VTermScreenCell &cell) {
+        // Only the first code point; combining characters are dropped.
+        c.ch = cell.chars[0] ? cell.chars[0] : ' ';
+        c.attrs = (cell.attrs.bold ? PackedCell::Bold : 0)
+                | (cell.attrs.italic ? PackedCell::Italic : 0)
+                | (cell.attrs.underline ? PackedCell::Underline : 0)
+                | (cell.attrs.reverse ? PackedCell::Inverse : 0);
+        c.fg = cellColor(cell.fg);
+        c.bg = cellColor(cell.bg);
+    }
 
-                // Handle UTF-8 char (only first char, ignoring wide chars)
-                if (cell.chars[0])
-                    c.ch = QChar(cell.chars[0]);
-                else
-                    c.ch = QChar(' ');
+    // Screen cells to widget pixels, below the history rows if scrolled back.
+    QRegion cellsToPixels(const QRegion &cells) const {
+        QRegion px;
+        int top = history.offset();
+        for (const QRect &r : cells)
+            px += QRect(r.x() * charWidth, (r.y() + top) * charHeight,
+                        r.width() * charWidth, r.height() * charHeight);
+        return px;
+    }
 
-                // Translate attributes to colors & styles
-                c.bold = (cell.attrs.bold != 0);
-                c.underline = (cell.attrs.underline != 0);
-                c.inverse = (cell.attrs.reverse != 0);
+    // GUI thread: refresh the damaged cells and repaint just those pixels.
+    void refreshDamaged() {
+        updateScreenFromVTerm();
+        latency.parsed();
+        syncHistory();
+        frameScheduler.requestFrame(cellsToPixels(cellDamage));
+        cellDamage = QRegion();
+    }
 
-                c.fg = qtColorFromVTermColor(cell.attrs.fg);
-                c.bg = qtColorFromVTermColor(cell.attrs.bg);
-            }
+    // Worker thread: refresh the cell buffer and publish a snapshot of it.
+    // The damage travels with the frame so paintEvent only redraws what
+    // changed, including frames the GUI skipped.
+    void publishFrame() {
+        qint64 start = counters.now();
+        updateScreenFromVTerm();
+        Frame &f = frames.back();
+        f.cells = screenBuffer;
+        f.cursorX = cursorX;
+        f.cursorY = cursorY;
+        f.cursorVisible = cursorVisible;
+        {
+            QMutexLocker lock(&scrollbackLock);
+            f.historyFirst = scrollback.droppedLines();
+            f.historyLines = scrollback.lineCount();
         }
+        QMutexLocker lock(&damageLock);
+        publishedDamage += cellDamage;
+        cellDamage = QRegion();
+        if (frames.publish())
+            counters.add(PerfCounters::FramesDropped);
+        counters.span("publish", start, counters.now());
+    }
 
-        VTermPos pos;
-        vterm_screen_get_cursor_pos(screen, &pos);
-        cursorY = pos.row;
-        cursorX = pos.col;
-    }
-
-    QColor qtColorFromVTermColor(VTermColor c) {
-        if (c.type == VTERM_COLOR_RGB) {
-            return QColor(c.rgb.red, c.rgb.green, c.rgb.blue);
-        } else if (c.type == VTERM_COLOR_DEFAULT) {
-            return Qt::white;
-        } else if (c.type == VTERM_COLOR_INDEX) {
-            static const QColor colors[16] = {
-                Qt::black, Qt::red, Qt::green, Qt::yellow,
-                Qt::blue, Qt::magenta, Qt::cyan, Qt::white,
-                QColor(128,128,128), QColor(255,0,0), QColor(0,255,0), QColor(255,255,0),
-                QColor(0,0,255), QColor(255,0,255), QColor(0,255,255), QColor(255,255,255)
-            };
-            int idx = c.index;
-            if (idx < 0 || idx > 15)
-                idx = 7;
-            return colors[idx];
-        }
-        return Qt::white;
+    static quint32 cellColor(const VTermColor &c) {
+        if (VTERM_COLOR_IS_DEFAULT_FG(&c) || VTERM_COLOR_IS_DEFAULT_BG(&c))
+            return CellColor::Default;
+        if (VTERM_COLOR_IS_INDEXED(&c))
+            return CellColor::indexed(c.indexed.idx);
+        return CellColor::rgb(c.rgb.red, c.rgb.green, c.rgb.blue);
     }
 };
 
@@ -335,6 +895,25 @@ int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
 
     TerminalWidget term;
+    if (app.arguments().contains("--render-benchmark")) {
+        QByteArray json = term.renderBenchmark();
+        fwrite(json.constData(), 1, size_t(json.size()), stdout);
+        return 0;
+    }
+    if (qEnvironmentVariableIsSet("QTERM_THREADED_READS"))
+        term.setThreadedReads(true);
+    if (qEnvironmentVariableIsSet("QTERM_THREADED_PARSING"))
+        term.setThreadedParsing(true);
+    if (qEnvironmentVariableIsSet("QTERM_LATENCY_PROBE"))
+        term.setLatencyProbeEnabled(true);
+    if (qEnvironmentVariableIsSet("QTERM_PERF_COUNTERS"))
+        term.perfCounters().setEnabled(true);
+    if (qEnvironmentVariableIsSet("QTERM_TRACE"))
+        term.setTraceFile(qEnvironmentVariable("QTERM_TRACE"));
+    if (qEnvironmentVariableIsSet("QTERM_SCROLLBACK_FILE")) {
+        QString path = qEnvironmentVariable("QTERM_SCROLLBACK_FILE");
+        term.setScrollbackFile(path.isEmpty() ? Scrollback::defaultSpillPath() : path, !path.isEmpty());
+    }
     term.resize(800, 450);
     term.show();
 
@@ -19,6 +19,19 @@ SOURCES += \
     main.cpp
 
 HEADERS += \
+    ../common/cellgrid.h \
+    ../common/framescheduler.h \
+    ../common/glyphatlas.h \
+    ../common/historyview.h \
+    ../common/latencyprobe.h \
+    ../common/parserworker.h \
+    ../common/perfcounters.h \
+    ../common/ptyreader.h \
+    ../common/ptywriter.h \
+    ../common/renderbench.h \
+    ../common/scrollback.h \
+    ../common/spscring.h \
+    ../common/triplebuffer.h
 
 FORMS += \
 
@@ -32,5 +45,5 @@ RESOURCES +=
 
 LIBS += -L/Users/macbook2015/Desktop/brew/lib -lvterm
 
-INCLUDEPATH += /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib /Users/macbook2015/Desktop/brew/Cellar/libvterm/0.3.3/include
+INCLUDEPATH += $$PWD/../common /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib /Users/macbook2015/Desktop/brew/Cellar/libvterm/0.3.3/include
 
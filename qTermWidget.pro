@@ -19,6 +19,19 @@ SOURCES += \
     main.cpp
 
 HEADERS += \
+    common/cellgrid.h \
+    common/framescheduler.h \
+    common/glyphatlas.h \
+    common/gridemulator.h \
+    common/historyview.h \
+    common/latencyprobe.h \
+    common/perfcounters.h \
+    common/ptyreader.h \
+    common/ptywriter.h \
+    common/renderbench.h \
+    common/scrollback.h \
+    common/spscring.h \
+    common/utf8.h
 
 FORMS += \
 
@@ -32,5 +45,5 @@ RESOURCES +=
 
 LIBS += -L/Users/macbook2015/Desktop/brew/lib -lssh
 
-INCLUDEPATH += /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib
+INCLUDEPATH += $$PWD/common /Users/macbook2015/Desktop/brew/include /Users/macbook2015/Desktop/brew/lib
 